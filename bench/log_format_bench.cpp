@@ -0,0 +1,107 @@
+/*
+ * Micro-benchmark of the log line formatting used by the serial and stdout sinks.
+ * Compares LogLineFormatter with the previous std::string/strftime formatting.
+ * Reports heap allocations and nanoseconds per line.
+ *
+ *   cmake -DFUS_CLI_BUILD_BENCH=ON ... && ./fs_updater_log_bench > bench_output.txt
+ */
+#include "../src/logger/LogLineFormatter.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <new>
+#include <string>
+
+namespace
+{
+    std::atomic<unsigned long> allocation_count{0};
+
+    constexpr unsigned long ITERATIONS = 1000000UL;
+
+    /* Previous LoggerSinkSerial::setLogEntry() formatting, kept as the baseline. */
+    std::size_t format_legacy(const logger::LogEntry &entry, std::string &sink)
+    {
+        const auto time_t_val = std::chrono::system_clock::to_time_t(entry.getTimepoint());
+        std::tm time_buf{};
+        localtime_r(&time_t_val, &time_buf);
+
+        std::array<char, 20> time_str{};
+        std::strftime(time_str.data(), time_str.size(), "%Y-%m-%d %H:%M:%S", &time_buf);
+
+        std::string out;
+        out.reserve(128);
+        out.append("WARNING");
+        out.append(": [");
+        out.append(time_str.data());
+        out.append("] - ");
+        out.append(entry.getLogDomain());
+        out.append(": ");
+        out.append(entry.getLogMessage());
+        sink.swap(out);
+        return sink.size();
+    }
+
+    template <typename Fn>
+    void run(const char *name, Fn &&format_line)
+    {
+        /* Warm up caches and the timestamp cache outside the measurement. */
+        volatile std::size_t bytes = format_line();
+
+        const unsigned long allocations_before = allocation_count.load();
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < ITERATIONS; ++i)
+        {
+            bytes = bytes + format_line();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const unsigned long allocations = allocation_count.load() - allocations_before;
+
+        const double ns_per_line =
+            static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+            static_cast<double>(ITERATIONS);
+        std::printf("%-16s %10.1f ns/line %8.3f allocations/line\n", name, ns_per_line,
+                    static_cast<double>(allocations) / static_cast<double>(ITERATIONS));
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+int main()
+{
+    const auto entry = std::make_shared<logger::LogEntry>(
+        "fsupdate", "Update image /mnt/usb/update.fs verified, installing firmware slot B",
+        logger::logLevel::WARNING);
+
+    std::array<char, logger::LogLineFormatter::LINE_MAX> line{};
+    run("LogLineFormatter", [&]() {
+        return logger::LogLineFormatter::format(*entry, line.data(), line.size(), false);
+    });
+
+    std::string legacy;
+    run("legacy", [&]() { return format_legacy(*entry, legacy); });
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/bin/bash
+set -e
+
+# Count system calls of fs-updater per command on the target (needs strace).
+# Run it once with the old and once with the new binary to compare.
+
+BINARY="${BINARY:-/usr/sbin/fs-updater}"
+STRACE="${STRACE:-strace}"
+
+usage() {
+    cat <<'USAGE'
+Usage: count-syscalls.sh [options] [-- <command args>]
+
+Runs every command once under "strace -c -f" and prints the total number of
+system calls and the number of file system calls (open, stat, read, getdents,
+close, ...). Process startup (dynamic loader, libc) is included in the total;
+compare the counts against --version to see the cost of the command itself.
+Note that --download_update and --install_update may create signal files.
+
+Options:
+  --binary <path>   fs-updater binary to trace (default: /usr/sbin/fs-updater)
+
+Environment:
+  BINARY, STRACE    Binary to trace, strace executable
+USAGE
+    exit 1
+}
+
+COMMANDS=()
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+    --binary) BINARY="$2"; shift ;;
+    --)       shift; COMMANDS+=("$*"); break ;;
+    *)
+        echo "Unknown option: $1"
+        usage
+        ;;
+    esac
+    shift
+done
+
+if [ ${#COMMANDS[@]} -eq 0 ]; then
+    COMMANDS=(
+        "--version"
+        "--is_update_available"
+        "--download_update"
+        "--download_progress"
+        "--install_update"
+        "--apply_update"
+    )
+fi
+
+[ -x "$BINARY" ] || { echo "Binary not found: $BINARY"; exit 1; }
+command -v "$STRACE" >/dev/null || { echo "strace not found: $STRACE"; exit 1; }
+
+FS_CALLS='^(open|openat|stat|newfstatat|fstatat64|statx|fstat|lstat|access|faccessat|read|getdents64|close|unlink|unlinkat)$'
+
+printf "%-28s %10s %10s\n" "command" "total" "fs_calls"
+
+for cmd in "${COMMANDS[@]}"; do
+    report=$(mktemp)
+    # shellcheck disable=SC2086
+    "$STRACE" -c -f -o "$report" "$BINARY" $cmd >/dev/null 2>&1 || true
+    # strace -c table: % time, seconds, usecs/call, calls, [errors], syscall
+    read -r total fs <<<"$(awk -v re="$FS_CALLS" '
+        /^-+/ || /^% time/ || /total$/ { next }
+        NF >= 5 { calls = $4; name = $NF; sum += calls; if (name ~ re) fs += calls }
+        END { printf "%d %d", sum, fs }' "$report")"
+    rm -f "$report"
+    printf "%-28s %10d %10d\n" "$cmd" "$total" "$fs"
+done
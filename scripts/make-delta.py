@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Create a delta for `fs-updater --update_file` (format: src/cli/DeltaPatch.h).
+
+The source is the image currently in the device's active application slot,
+the target is the new update file (signed application image or .fs bundle).
+Source blocks at a 512-byte grid are indexed by a rolling checksum; the
+target is scanned one byte at a time, so a block is found again at any
+offset, also after inserted or deleted data. Matches are encoded as copies;
+everything else is carried as literal data.
+
+  make-delta.py --self-test   round-trips offset edits and checks the copy ratio
+"""
+import argparse
+import hashlib
+import operator
+import random
+import struct
+import sys
+
+WINDOW = 4096
+GRID = 512
+WEIGHTS = range(WINDOW, 0, -1)
+# Candidates kept per checksum; repeated content (e.g. zero fill) needs only a few.
+CANDIDATES = 4
+
+
+def checksum(block):
+    """rsync-style weak checksum: a = sum of bytes, b = sum of a over the prefixes."""
+    a = sum(block) & 0xFFFF
+    b = sum(map(operator.mul, block, WEIGHTS)) & 0xFFFF
+    return a, b
+
+
+def index_source(source):
+    blocks = {}
+    for offset in range(0, len(source) - WINDOW + 1, GRID):
+        a, b = checksum(source[offset:offset + WINDOW])
+        offsets = blocks.setdefault(a | (b << 16), [])
+        if len(offsets) < CANDIDATES and all(source[o:o + WINDOW] != source[offset:offset + WINDOW] for o in offsets):
+            offsets.append(offset)
+    return blocks
+
+
+def forward_match(source, s, target, t):
+    """Length of the common run source[s:] / target[t:], compared in doubling slices."""
+    limit = min(len(source) - s, len(target) - t)
+    length = 0
+    step = WINDOW
+    while length < limit:
+        count = min(step, limit - length)
+        if source[s + length:s + length + count] == target[t + length:t + length + count]:
+            length += count
+            step = min(step * 2, 1 << 20)
+        elif count == 1:
+            break
+        else:
+            step = count // 2
+    return length
+
+
+def backward_match(source, s, target, t, limit):
+    """Length of the common run ending before source[s] / target[t], at most limit."""
+    limit = min(limit, s)
+    length = 0
+    step = GRID
+    while length < limit:
+        count = min(step, limit - length)
+        if source[s - length - count:s - length] == target[t - length - count:t - length]:
+            length += count
+            step *= 2
+        elif count == 1:
+            break
+        else:
+            step = count // 2
+    return length
+
+
+def operations(source, target):
+    blocks = index_source(source)
+    ops = []
+    literal_start = 0
+    pos = 0
+    rolling = None
+    while pos + WINDOW <= len(target):
+        if rolling is None:
+            a, b = checksum(target[pos:pos + WINDOW])
+        else:
+            # Roll by one byte: drop target[pos - 1], add target[pos + WINDOW - 1].
+            out, new = target[pos - 1], target[pos + WINDOW - 1]
+            a = (a - out + new) & 0xFFFF
+            b = (b - WINDOW * out + a) & 0xFFFF
+        rolling = True
+
+        found = None
+        for offset in blocks.get(a | (b << 16), ()):
+            if source[offset:offset + WINDOW] == target[pos:pos + WINDOW]:
+                found = offset
+                break
+        if found is None:
+            pos += 1
+            continue
+
+        back = backward_match(source, found, target, pos, pos - literal_start)
+        found -= back
+        pos -= back
+        if literal_start < pos:
+            ops.append(("A", literal_start, pos - literal_start))
+        length = forward_match(source, found, target, pos)
+        if ops and ops[-1][0] == "C" and ops[-1][1] + ops[-1][2] == found:
+            ops[-1] = ("C", ops[-1][1], ops[-1][2] + length)
+        else:
+            ops.append(("C", found, length))
+        pos += length
+        literal_start = pos
+        rolling = None
+    if literal_start < len(target):
+        ops.append(("A", literal_start, len(target) - literal_start))
+    return ops
+
+
+def encode(source, target):
+    """Return the delta and the number of target bytes copied from the source."""
+    parts = [b"FSDELTA1",
+             struct.pack("<Q", len(source)) + hashlib.sha256(source).digest(),
+             struct.pack("<Q", len(target)) + hashlib.sha256(target).digest()]
+    copied = 0
+    for kind, offset, length in operations(source, target):
+        if kind == "C":
+            parts.append(b"C" + struct.pack("<QQ", offset, length))
+            copied += length
+        else:
+            parts.append(b"A" + struct.pack("<Q", length) + target[offset:offset + length])
+    parts.append(b"E")
+    return b"".join(parts), copied
+
+
+def decode(source, delta):
+    """Rebuild the target as DeltaPatch does; raises ValueError on a bad delta."""
+    if delta[:8] != b"FSDELTA1":
+        raise ValueError("no delta")
+    if struct.unpack_from("<Q", delta, 8)[0] != len(source) or delta[16:48] != hashlib.sha256(source).digest():
+        raise ValueError("source mismatch")
+    target_size, target_sha = struct.unpack_from("<Q", delta, 48)[0], delta[56:88]
+    out = bytearray()
+    pos = 88
+    while delta[pos:pos + 1] != b"E":
+        if delta[pos:pos + 1] == b"C":
+            offset, length = struct.unpack_from("<QQ", delta, pos + 1)
+            out += source[offset:offset + length]
+            pos += 17
+        elif delta[pos:pos + 1] == b"A":
+            length = struct.unpack_from("<Q", delta, pos + 1)[0]
+            out += delta[pos + 9:pos + 9 + length]
+            pos += 9 + length
+        else:
+            raise ValueError("bad operation at %d" % pos)
+    if len(out) != target_size or hashlib.sha256(out).digest() != target_sha:
+        raise ValueError("target mismatch")
+    return bytes(out)
+
+
+def self_test():
+    rng = random.Random(1)
+    source = bytes(rng.getrandbits(8) for _ in range(400000))
+    middle = len(source) // 2
+    cases = [
+        ("unchanged", source, len(source)),
+        ("100-byte insert in the middle", source[:middle] + b"x" * 100 + source[middle:], len(source)),
+        ("1000-byte delete at the head", source[1000:], len(source) - 1000),
+        ("7-byte replace at an odd offset", source[:12345] + b"changed" + source[12352:], len(source) - 7),
+        ("3-byte insert every 50000 bytes",
+         b"".join(source[i:i + 50000] + b"abc" for i in range(0, len(source), 50000)), len(source)),
+    ]
+    failed = False
+    for name, target, expected in cases:
+        delta, copied = encode(source, target)
+        ok = decode(source, delta) == target
+        # The backward match recovers the bytes before the first matching block,
+        # so an edit may cost at most one grid step of literal data.
+        ok = ok and copied >= expected - GRID
+        failed |= not ok
+        print(f"{'ok  ' if ok else 'FAIL'} {name}: {copied} of {len(target)} bytes copied, "
+              f"delta {len(delta)} bytes", file=sys.stderr)
+    return 1 if failed else 0
+
+
+def main():
+    if sys.argv[1:] == ["--self-test"]:
+        sys.exit(self_test())
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="image in the active application slot")
+    parser.add_argument("target", help="new update file")
+    parser.add_argument("delta", help="output delta file")
+    args = parser.parse_args()
+
+    with open(args.source, "rb") as f:
+        source = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+
+    delta, copied = encode(source, target)
+    with open(args.delta, "wb") as out:
+        out.write(delta)
+
+    print(f"{args.delta}: {len(delta)} bytes, {copied} of {len(target)} target bytes copied from the slot",
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+#!/bin/bash
+set -e
+
+# Measure wall-clock startup latency of fs-updater per command on the target.
+# Run it once with the old and once with the new binary to compare.
+
+BINARY="${BINARY:-/usr/sbin/fs-updater}"
+RUNS="${RUNS:-50}"
+
+usage() {
+    cat <<'EOF'
+Usage: measure-startup.sh [options] [-- <command args>]
+
+Runs every command RUNS times and prints min / mean wall time in microseconds.
+Without a command, the default set of polling commands is measured.
+Note that --download_update and --install_update may create signal files.
+
+Options:
+  --binary <path>   fs-updater binary to measure (default: /usr/sbin/fs-updater)
+  --runs <n>        Iterations per command (default: 50)
+
+Environment:
+  BINARY, RUNS      Same as the options above
+EOF
+    exit 1
+}
+
+COMMANDS=()
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+    --binary) BINARY="$2"; shift ;;
+    --runs)   RUNS="$2"; shift ;;
+    --)       shift; COMMANDS+=("$*"); break ;;
+    *)
+        echo "Unknown option: $1"
+        usage
+        ;;
+    esac
+    shift
+done
+
+if [ ${#COMMANDS[@]} -eq 0 ]; then
+    COMMANDS=(
+        "--version"
+        "--is_update_available"
+        "--download_update"
+        "--download_progress"
+        "--install_update"
+        "--is_app_state_bad A"
+        "--is_fw_state_bad A"
+        "--firmware_version"
+        "--application_version"
+        "--update_reboot_state"
+    )
+fi
+
+[ -x "$BINARY" ] || { echo "Binary not found: $BINARY"; exit 1; }
+
+printf "%-28s %10s %10s\n" "command" "min_us" "mean_us"
+
+for cmd in "${COMMANDS[@]}"; do
+    min=""
+    total=0
+    for _ in $(seq "$RUNS"); do
+        start=$(date +%s%N)
+        # shellcheck disable=SC2086
+        "$BINARY" $cmd >/dev/null 2>&1 || true
+        end=$(date +%s%N)
+        us=$(( (end - start) / 1000 ))
+        total=$(( total + us ))
+        if [ -z "$min" ] || [ "$us" -lt "$min" ]; then
+            min=$us
+        fi
+    done
+    printf "%-28s %10d %10d\n" "$cmd" "$min" "$(( total / RUNS ))"
+done
@@ -0,0 +1,130 @@
+#include "BlockWriter.h"
+#include "Throttle.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    bool all_zero(const uint8_t *data, size_t length)
+    {
+        return length == 0U || (data[0] == 0U && std::memcmp(data, data + 1, length - 1U) == 0);
+    }
+}
+
+cli::BlockWriter::BlockWriter(int fd)
+    : fd(fd), block(BLOCK)
+{
+    struct stat st{};
+    if (::fstat(this->fd, &st) != 0)
+    {
+        return;
+    }
+    this->regular = S_ISREG(st.st_mode);
+    if (this->regular)
+    {
+        this->existing_size = static_cast<uint64_t>(st.st_size);
+    }
+}
+
+bool cli::BlockWriter::write(const void *data, size_t length)
+{
+    const auto *next = static_cast<const uint8_t *>(data);
+
+    /* Whole blocks straight from the caller's buffer, the rest via block. */
+    while (length > 0U)
+    {
+        if (this->fill == 0U && length >= BLOCK)
+        {
+            if (!this->commit(next, BLOCK))
+            {
+                return false;
+            }
+            next += BLOCK;
+            length -= BLOCK;
+            continue;
+        }
+        const size_t take = std::min(length, BLOCK - this->fill);
+        std::memcpy(this->block.data() + this->fill, next, take);
+        this->fill += take;
+        next += take;
+        length -= take;
+        if (this->fill == BLOCK)
+        {
+            this->fill = 0U;
+            if (!this->commit(this->block.data(), BLOCK))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool cli::BlockWriter::finish()
+{
+    if (this->fill > 0U)
+    {
+        const size_t length = this->fill;
+        this->fill = 0U;
+        if (!this->commit(this->block.data(), length))
+        {
+            return false;
+        }
+    }
+    if (this->regular && this->offset > this->existing_size)
+    {
+        return ::ftruncate(this->fd, static_cast<off_t>(this->offset)) == 0;
+    }
+    return true;
+}
+
+bool cli::BlockWriter::commit(const uint8_t *data, size_t length)
+{
+    if (this->regular && all_zero(data, length))
+    {
+        /* Past the old end nothing is allocated yet; inside it the old data
+         * is released. Without hole punching the zeros are written.
+         */
+        if (this->offset >= this->existing_size ||
+            ::fallocate(this->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        static_cast<off_t>(this->offset), static_cast<off_t>(length)) == 0)
+        {
+            this->sparse_bytes += length;
+            return this->skip(length);
+        }
+    }
+
+    if (this->pacer != nullptr)
+    {
+        this->pacer->consume(length);
+    }
+    const uint8_t *next = data;
+    size_t left = length;
+    while (left > 0U)
+    {
+        const ssize_t n = ::write(this->fd, next, left);
+        if (n < 0)
+        {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        next += n;
+        left -= static_cast<size_t>(n);
+    }
+    this->written_bytes += length;
+    this->offset += length;
+    return true;
+}
+
+bool cli::BlockWriter::skip(size_t length)
+{
+    this->offset += length;
+    return ::lseek(this->fd, static_cast<off_t>(this->offset), SEEK_SET) >= 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cli
+{
+    class Throttle;
+
+    /**
+     * Sequential writer that leaves zero blocks out. All-zero blocks are not
+     * written to regular files: they become holes (punched where the file
+     * had data, left unallocated past its end). Other destinations get
+     * every block written. The file position advances as if every byte was
+     * written, so readers of /proc/self/fdinfo see the real progress.
+     */
+    class BlockWriter
+    {
+        public:
+            /// Unit of the zero check; a multiple of common file system and eMMC erase sizes.
+            static constexpr size_t BLOCK = 64U * 1024U;
+
+            /**
+             * @param fd Destination, positioned at offset 0; not owned.
+             */
+            explicit BlockWriter(int fd);
+
+            BlockWriter(const BlockWriter &) = delete;
+            BlockWriter &operator=(const BlockWriter &) = delete;
+
+            /**
+             * Append data; full blocks are committed immediately.
+             * @return false on error (errno set).
+             */
+            [[nodiscard]] bool write(const void *data, size_t length);
+
+            /**
+             * Commit the last partial block and extend a regular file to the
+             * written size, so a trailing hole is not lost.
+             * @return false on error (errno set).
+             */
+            [[nodiscard]] bool finish();
+
+            /**
+             * Pace the blocks that are actually written; holes are free.
+             * @param throttle Rate limiter, nullptr for none; not owned.
+             */
+            void set_throttle(Throttle *throttle) { this->pacer = throttle; }
+
+            uint64_t size() const { return this->offset + this->fill; }   ///< Bytes accepted
+            uint64_t committed() const { return this->offset; }           ///< Bytes passed to the destination
+            uint64_t written() const { return this->written_bytes; }      ///< Bytes actually written
+            uint64_t sparse() const { return this->sparse_bytes; }        ///< Zero bytes left as holes
+
+        private:
+            int fd;
+            Throttle *pacer{nullptr};
+            bool regular{false};
+            uint64_t existing_size{0};    ///< Destination size when opened
+            uint64_t offset{0};
+            size_t fill{0};
+            std::vector<uint8_t> block;
+            uint64_t written_bytes{0};
+            uint64_t sparse_bytes{0};
+
+            bool commit(const uint8_t *data, size_t length);
+            bool skip(size_t length);
+    };
+}
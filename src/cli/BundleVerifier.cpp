@@ -0,0 +1,450 @@
+#include "BundleVerifier.h"
+#include "config.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <botan/hash.h>
+#include <botan/hex.h>
+#include <json/json.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace
+{
+    constexpr char MANIFEST_NAME[] = "fsupdate.json";
+    /* fsupdate.json lists a handful of components; anything larger is not a manifest. */
+    constexpr size_t MANIFEST_MAX = 1024U * 1024U;
+    /* Large blocks keep the read sequential; USB sticks and eMMC both profit. */
+    constexpr size_t READ_BLOCK = 256U * 1024U;
+
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t elapsed_ns(Clock::time_point start)
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    }
+
+    /* Members are stored as "name" or "./name". */
+    string member_name(const char *pathname)
+    {
+        string name = (pathname != nullptr) ? pathname : "";
+        while (name.compare(0, 2, "./") == 0)
+        {
+            name.erase(0, 2);
+        }
+        return name;
+    }
+
+    string lower(string value)
+    {
+        std::transform(value.begin(), value.end(), value.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return value;
+    }
+
+    string archive_error(struct archive *a)
+    {
+        const char *text = ::archive_error_string(a);
+        return (text != nullptr) ? text : "unknown archive error";
+    }
+
+    struct ArchiveDeleter
+    {
+        void operator()(struct archive *a) const { static_cast<void>(::archive_read_free(a)); }
+    };
+
+    class FileDescriptor
+    {
+        public:
+            explicit FileDescriptor(int fd) : fd(fd) {}
+            ~FileDescriptor() { if (this->fd >= 0) { ::close(this->fd); } }
+            FileDescriptor(const FileDescriptor &) = delete;
+            FileDescriptor &operator=(const FileDescriptor &) = delete;
+            int get() const { return this->fd; }
+
+        private:
+            int fd;
+    };
+}
+
+cli::BundleVerifier::BundleVerifier(string bundle_path) : path(std::move(bundle_path))
+{
+}
+
+cli::BundleVerifier::Result cli::BundleVerifier::run()
+{
+    const Clock::time_point start = Clock::now();
+    Result result = this->stream();
+    this->total_ns = elapsed_ns(start);
+
+    if (result != Result::VERIFIED)
+    {
+        return result;
+    }
+    if (!this->parse_manifest())
+    {
+        return Result::MANIFEST_INVALID;
+    }
+
+    for (auto &component : this->listed)
+    {
+        const auto member = std::find_if(this->members.begin(), this->members.end(),
+            [&component](const Member &m) { return m.name == component.file; });
+        if (member == this->members.end())
+        {
+            result = Result::MISMATCH;
+            continue;
+        }
+        component.sha256 = member->sha256;
+        component.size = member->size;
+        component.nanoseconds = member->nanoseconds;
+        if (component.sha256 != component.expected_sha256)
+        {
+            result = Result::MISMATCH;
+        }
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Hash workers
+// ---------------------------------------------------------------------------
+
+/* Blocks travel from the reader to the worker of their member through a
+ * bounded pool of buffers, so memory stays at BUFFERS_PER_WORKER * READ_BLOCK
+ * per worker however large the bundle is.
+ */
+class cli::BundleVerifier::HashPipeline
+{
+    public:
+        explicit HashPipeline(size_t count)
+        {
+            for (size_t i = 0; i < count * BUFFERS_PER_WORKER; ++i)
+            {
+                this->storage.push_back(std::make_unique<uint8_t[]>(READ_BLOCK));
+                this->free_buffers.push_back(this->storage.back().get());
+            }
+            /* Everything that may throw comes before the first thread starts. */
+            for (size_t i = 0; i < count; ++i)
+            {
+                this->workers.push_back(std::make_unique<Worker>());
+                this->workers.back()->hash = Botan::HashFunction::create_or_throw("SHA-256");
+            }
+            for (auto &worker : this->workers)
+            {
+                worker->thread = std::thread(&HashPipeline::run, this, std::ref(*worker));
+            }
+        }
+
+        /* Pending blocks are still hashed; the pool bounds how many there are. */
+        ~HashPipeline()
+        {
+            {
+                const std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopping = true;
+            }
+            for (auto &worker : this->workers)
+            {
+                worker->ready.notify_one();
+            }
+            for (auto &worker : this->workers)
+            {
+                worker->thread.join();
+            }
+        }
+
+        HashPipeline(const HashPipeline &) = delete;
+        HashPipeline &operator=(const HashPipeline &) = delete;
+
+        /** Assign the next worker to a member about to be read. */
+        void begin(Member &member)
+        {
+            member.worker = this->next_worker;
+            this->next_worker = (this->next_worker + 1U) % this->workers.size();
+            member.started = Clock::now();
+        }
+
+        /** @return Free buffer of READ_BLOCK bytes; waits while all are queued. */
+        uint8_t *acquire()
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->buffer_free.wait(lock, [this] { return !this->free_buffers.empty(); });
+            uint8_t *buffer = this->free_buffers.back();
+            this->free_buffers.pop_back();
+            return buffer;
+        }
+
+        /** Return a buffer that was not submitted. */
+        void release(uint8_t *buffer)
+        {
+            {
+                const std::lock_guard<std::mutex> lock(this->mutex);
+                this->free_buffers.push_back(buffer);
+            }
+            this->buffer_free.notify_one();
+        }
+
+        void submit(Member &member, uint8_t *buffer, size_t length)
+        {
+            this->push(Block{&member, buffer, length});
+        }
+
+        /** Queue the end of a member; its digest is set once the worker gets there. */
+        void finish(Member &member)
+        {
+            this->push(Block{&member, nullptr, 0});
+        }
+
+        /** Wait until every queued block is hashed. */
+        void drain()
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->idle.wait(lock, [this] { return this->pending == 0U; });
+        }
+
+    private:
+        static constexpr size_t BUFFERS_PER_WORKER = 4;
+
+        struct Block
+        {
+            Member *member;
+            uint8_t *data;      ///< nullptr marks the end of the member
+            size_t length;
+        };
+
+        struct Worker
+        {
+            std::thread thread;
+            std::condition_variable ready;
+            std::deque<Block> queue;
+            std::unique_ptr<Botan::HashFunction> hash;
+        };
+
+        std::mutex mutex;
+        std::condition_variable buffer_free;
+        std::condition_variable idle;
+        std::vector<std::unique_ptr<uint8_t[]>> storage;
+        std::vector<uint8_t *> free_buffers;
+        std::vector<std::unique_ptr<Worker>> workers;
+        size_t next_worker{0};
+        size_t pending{0};
+        bool stopping{false};
+
+        void push(const Block &block)
+        {
+            Worker &worker = *this->workers[block.member->worker];
+            {
+                const std::lock_guard<std::mutex> lock(this->mutex);
+                worker.queue.push_back(block);
+                ++this->pending;
+            }
+            worker.ready.notify_one();
+        }
+
+        void run(Worker &worker)
+        {
+            std::array<uint8_t, 32> digest{};
+            std::unique_lock<std::mutex> lock(this->mutex);
+            for (;;)
+            {
+                worker.ready.wait(lock, [this, &worker] { return this->stopping || !worker.queue.empty(); });
+                if (worker.queue.empty())
+                {
+                    return;
+                }
+                const Block block = worker.queue.front();
+                worker.queue.pop_front();
+                lock.unlock();
+
+                if (block.data != nullptr)
+                {
+                    worker.hash->update(block.data, block.length);
+                }
+                else
+                {
+                    worker.hash->final(digest.data());
+                    block.member->sha256 = Botan::hex_encode(digest.data(), digest.size(), false);
+                    block.member->nanoseconds = elapsed_ns(block.member->started);
+                }
+
+                lock.lock();
+                if (block.data != nullptr)
+                {
+                    this->free_buffers.push_back(block.data);
+                    this->buffer_free.notify_one();
+                }
+                if (--this->pending == 0U)
+                {
+                    this->idle.notify_all();
+                }
+            }
+        }
+};
+
+// ---------------------------------------------------------------------------
+// Streaming pass
+// ---------------------------------------------------------------------------
+
+cli::BundleVerifier::Result cli::BundleVerifier::stream()
+{
+    const FileDescriptor fd(::open(this->path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() < 0)
+    {
+        this->message = string("cannot open bundle: ") + std::strerror(errno);
+        return Result::READ_FAILED;
+    }
+    /* One forward pass; let the kernel read ahead aggressively. */
+    static_cast<void>(::posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL));
+
+    std::unique_ptr<struct archive, ArchiveDeleter> reader(::archive_read_new());
+    if (!reader)
+    {
+        this->message = "out of memory";
+        return Result::READ_FAILED;
+    }
+    static_cast<void>(::archive_read_support_filter_all(reader.get()));
+    static_cast<void>(::archive_read_support_format_all(reader.get()));
+
+    if (::archive_read_open_fd(reader.get(), fd.get(), READ_BLOCK) != ARCHIVE_OK)
+    {
+        this->message = string("not an update bundle: ") + archive_error(reader.get());
+        return Result::MANIFEST_INVALID;
+    }
+
+    /* Declared after the reader: destroyed, and its workers joined, first. */
+    HashPipeline pipeline(FUS_CLI_VERIFY_WORKERS);
+    struct archive_entry *entry = nullptr;
+    int status = ARCHIVE_OK;
+
+    while ((status = ::archive_read_next_header(reader.get(), &entry)) == ARCHIVE_OK ||
+           status == ARCHIVE_WARN)
+    {
+        if (::archive_entry_filetype(entry) != AE_IFREG)
+        {
+            continue;
+        }
+
+        Member &member = this->members.emplace_back();
+        member.name = member_name(::archive_entry_pathname(entry));
+        const bool is_manifest = (member.name == MANIFEST_NAME);
+        pipeline.begin(member);
+
+        for (;;)
+        {
+            /* archive_read_data() fills holes of sparse members with zeros. */
+            uint8_t *buffer = pipeline.acquire();
+            const la_ssize_t length = ::archive_read_data(reader.get(), buffer, READ_BLOCK);
+            if (length <= 0)
+            {
+                pipeline.release(buffer);
+                if (length < 0)
+                {
+                    this->message = "reading " + member.name + ": " + archive_error(reader.get());
+                    return Result::READ_FAILED;
+                }
+                break;
+            }
+
+            if (is_manifest)
+            {
+                if (this->manifest.size() + static_cast<size_t>(length) > MANIFEST_MAX)
+                {
+                    pipeline.release(buffer);
+                    this->message = "fsupdate.json exceeds " + std::to_string(MANIFEST_MAX) + " bytes";
+                    return Result::MANIFEST_INVALID;
+                }
+                this->manifest.append(reinterpret_cast<const char *>(buffer), static_cast<size_t>(length));
+            }
+            member.size += static_cast<uint64_t>(length);
+            pipeline.submit(member, buffer, static_cast<size_t>(length));
+        }
+        pipeline.finish(member);
+    }
+
+    this->archive_bytes = static_cast<uint64_t>(::archive_filter_bytes(reader.get(), -1));
+    pipeline.drain();
+
+    if (status != ARCHIVE_EOF)
+    {
+        /* The format is only detected with the first header. */
+        if (::archive_file_count(reader.get()) == 0)
+        {
+            this->message = string("not an update bundle: ") + archive_error(reader.get());
+            return Result::MANIFEST_INVALID;
+        }
+        this->message = string("reading bundle: ") + archive_error(reader.get());
+        return Result::READ_FAILED;
+    }
+    return Result::VERIFIED;
+}
+
+// ---------------------------------------------------------------------------
+// Manifest
+// ---------------------------------------------------------------------------
+
+bool cli::BundleVerifier::parse_manifest()
+{
+    const bool present = std::any_of(this->members.begin(), this->members.end(),
+        [](const Member &m) { return m.name == MANIFEST_NAME; });
+    if (!present)
+    {
+        this->message = "fsupdate.json not found in bundle";
+        return false;
+    }
+
+    Json::CharReaderBuilder builder;
+    Json::Value root;
+    string errors;
+    std::istringstream input(this->manifest);
+    if (!Json::parseFromStream(builder, input, &root, &errors))
+    {
+        this->message = "fsupdate.json: " + errors;
+        return false;
+    }
+
+    const Json::Value &updates = root["updates"];
+    if (!updates.isArray() || updates.empty())
+    {
+        this->message = "fsupdate.json lists no updates";
+        return false;
+    }
+
+    for (const auto &update : updates)
+    {
+        if (!update.isObject() || !update["file"].isString() ||
+            !update["hashes"].isObject() || !update["hashes"]["sha256"].isString())
+        {
+            this->message = "fsupdate.json: every update needs \"file\" and \"hashes\": {\"sha256\"}";
+            return false;
+        }
+
+        Component component;
+        component.file = member_name(update["file"].asCString());
+        component.handler = update["handler"].isString() ? update["handler"].asString() : "";
+        component.version = update["version"].isConvertibleTo(Json::stringValue) ? update["version"].asString() : "";
+        component.expected_sha256 = lower(update["hashes"]["sha256"].asString());
+
+        if (component.file.empty() || component.expected_sha256.size() != 64U)
+        {
+            this->message = "fsupdate.json: update \"" + component.file + "\" has no file name or sha256";
+            return false;
+        }
+        this->listed.push_back(std::move(component));
+    }
+    return true;
+}
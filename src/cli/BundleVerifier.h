@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace cli
+{
+    /**
+     * Pre-flight check of a .fs update bundle. The bundle is read once,
+     * sequentially, through libarchive: every member is hashed with SHA-256
+     * while it streams by and fsupdate.json is kept in memory. Afterwards the
+     * digests are compared with the ones listed in fsupdate.json. Nothing is
+     * extracted and neither the work directory nor the slots are touched.
+     *
+     * Reading and hashing overlap: the calling thread reads the archive and
+     * hands the blocks to FUS_CLI_VERIFY_WORKERS hash threads, one member per
+     * thread in turn, so the firmware and application images of a combined
+     * bundle are hashed on different cores.
+     */
+    class BundleVerifier
+    {
+        public:
+            enum class Result
+            {
+                VERIFIED,           ///< Every listed component present with matching digest
+                MISMATCH,           ///< A component is missing or its digest differs
+                MANIFEST_INVALID,   ///< Not a bundle, no or unusable fsupdate.json
+                READ_FAILED         ///< I/O or archive error while streaming
+            };
+
+            /**
+             * One component listed in fsupdate.json.
+             */
+            struct Component
+            {
+                std::string file;
+                std::string handler;
+                std::string version;
+                std::string expected_sha256;
+                std::string sha256;     ///< Empty if the member was not found
+                uint64_t size{0};
+                uint64_t nanoseconds{0}; ///< Time spent reading and hashing the member
+            };
+
+            /**
+             * @param path Bundle file.
+             */
+            explicit BundleVerifier(std::string path);
+
+            /**
+             * Stream the bundle and check it; call once.
+             * @return Overall result, details in components() and error().
+             */
+            Result run();
+
+            const std::vector<Component> &components() const { return this->listed; }
+
+            /**
+             * @return Reason of a MANIFEST_INVALID or READ_FAILED result.
+             */
+            const std::string &error() const { return this->message; }
+
+            /**
+             * @return Bytes of the bundle file read.
+             */
+            uint64_t bytes_read() const { return this->archive_bytes; }
+
+            /**
+             * @return Duration of the whole pass.
+             */
+            uint64_t nanoseconds() const { return this->total_ns; }
+
+        private:
+            /** Digest of one archive member, collected before the manifest is known. */
+            struct Member
+            {
+                std::string name;
+                std::string sha256;     ///< Set by the hash worker
+                uint64_t size{0};
+                uint64_t nanoseconds{0}; ///< Set by the hash worker
+                std::chrono::steady_clock::time_point started;
+                size_t worker{0};
+            };
+
+            class HashPipeline;
+
+            std::string path;
+            std::string manifest;
+            /* Hash workers hold references to members; a deque keeps them stable. */
+            std::deque<Member> members;
+            std::vector<Component> listed;
+            std::string message;
+            uint64_t archive_bytes{0};
+            uint64_t total_ns{0};
+
+            Result stream();
+            bool parse_manifest();
+    };
+}
@@ -0,0 +1,213 @@
+#include "DeltaPatch.h"
+#include "SpoolFile.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <botan/hash.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace
+{
+    constexpr char DELTA_MAGIC[] = "FSDELTA1";
+    constexpr size_t MAGIC_SIZE = sizeof(DELTA_MAGIC) - 1U;
+    constexpr size_t DIGEST_SIZE = 32U;
+    constexpr size_t BLOCK = 256U * 1024U;
+
+    using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+    /* Owns a descriptor; the delta and the slot are closed on every path. */
+    class Fd
+    {
+        public:
+            explicit Fd(int fd) : fd(fd) {}
+            ~Fd() { if (this->fd >= 0) { ::close(this->fd); } }
+            Fd(const Fd &) = delete;
+            Fd &operator=(const Fd &) = delete;
+            int get() const { return this->fd; }
+
+        private:
+            int fd;
+    };
+
+    /* Full read at the current offset (offset < 0) or at offset; false on error or early end. */
+    bool read_exact(int fd, void *buffer, size_t length, int64_t offset = -1)
+    {
+        auto *next = static_cast<uint8_t *>(buffer);
+        while (length > 0U)
+        {
+            const ssize_t n = (offset < 0) ? ::read(fd, next, length)
+                                           : ::pread(fd, next, length, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0)
+            {
+                if (n == 0) { errno = 0; }
+                return false;
+            }
+            next += n;
+            length -= static_cast<size_t>(n);
+            if (offset >= 0) { offset += n; }
+        }
+        return true;
+    }
+
+    bool read_u64(int fd, uint64_t &value)
+    {
+        uint8_t bytes[8];
+        if (!read_exact(fd, bytes, sizeof(bytes)))
+        {
+            return false;
+        }
+        value = 0U;
+        for (size_t i = 0; i < sizeof(bytes); ++i)
+        {
+            value |= static_cast<uint64_t>(bytes[i]) << (8U * i);
+        }
+        return true;
+    }
+
+    Digest finish(Botan::HashFunction &hash)
+    {
+        Digest digest{};
+        hash.final(digest.data());
+        return digest;
+    }
+}
+
+bool cli::DeltaPatch::is_delta(const string &path)
+{
+    const Fd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    char magic[MAGIC_SIZE];
+    return fd.get() >= 0 && read_exact(fd.get(), magic, sizeof(magic)) &&
+           std::memcmp(magic, DELTA_MAGIC, MAGIC_SIZE) == 0;
+}
+
+cli::DeltaPatch::DeltaPatch(string delta, string source)
+    : delta_path(std::move(delta)), source_path(std::move(source))
+{
+}
+
+cli::DeltaPatch::Result cli::DeltaPatch::fail(Result result, const string &reason)
+{
+    this->message = reason;
+    if (result == Result::IO_FAILED && errno != 0)
+    {
+        this->message += string(": ") + std::strerror(errno);
+    }
+    return result;
+}
+
+cli::DeltaPatch::Result cli::DeltaPatch::apply(SpoolFile &out)
+{
+    const Fd delta(::open(this->delta_path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (delta.get() < 0)
+    {
+        return this->fail(Result::IO_FAILED, "cannot open " + this->delta_path);
+    }
+    static_cast<void>(::posix_fadvise(delta.get(), 0, 0, POSIX_FADV_SEQUENTIAL));
+
+    char magic[MAGIC_SIZE];
+    Digest source_digest{};
+    Digest target_digest{};
+    if (!read_exact(delta.get(), magic, sizeof(magic)) || std::memcmp(magic, DELTA_MAGIC, MAGIC_SIZE) != 0 ||
+        !read_u64(delta.get(), this->source_length) ||
+        !read_exact(delta.get(), source_digest.data(), DIGEST_SIZE) ||
+        !read_u64(delta.get(), this->target_length) ||
+        !read_exact(delta.get(), target_digest.data(), DIGEST_SIZE))
+    {
+        return this->fail(Result::FORMAT_INVALID, "delta header incomplete");
+    }
+
+    const Fd source(::open(this->source_path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (source.get() < 0)
+    {
+        return this->fail(Result::IO_FAILED, "cannot open source slot " + this->source_path);
+    }
+
+    /* The slot may be larger than the image; only the image is compared. */
+    const std::unique_ptr<Botan::HashFunction> hash = Botan::HashFunction::create_or_throw("SHA-256");
+    std::vector<uint8_t> buffer(BLOCK);
+    static_cast<void>(::posix_fadvise(source.get(), 0, static_cast<off_t>(this->source_length), POSIX_FADV_SEQUENTIAL));
+    for (uint64_t offset = 0U; offset < this->source_length;)
+    {
+        const size_t length = static_cast<size_t>(std::min<uint64_t>(BLOCK, this->source_length - offset));
+        if (!read_exact(source.get(), buffer.data(), length, static_cast<int64_t>(offset)))
+        {
+            if (errno == 0)
+            {
+                return this->fail(Result::SOURCE_MISMATCH, "source slot " + this->source_path + " is smaller than the delta source");
+            }
+            return this->fail(Result::IO_FAILED, "reading source slot " + this->source_path);
+        }
+        hash->update(buffer.data(), length);
+        offset += length;
+    }
+    if (finish(*hash) != source_digest)
+    {
+        return this->fail(Result::SOURCE_MISMATCH, "source slot " + this->source_path + " does not hold the image this delta was made against");
+    }
+    static_cast<void>(::posix_fadvise(source.get(), 0, 0, POSIX_FADV_RANDOM));
+
+    uint64_t written = 0U;
+    for (;;)
+    {
+        uint8_t op = 0U;
+        if (!read_exact(delta.get(), &op, 1U))
+        {
+            return this->fail(Result::FORMAT_INVALID, "delta ends without end marker");
+        }
+        if (op == 'E')
+        {
+            break;
+        }
+
+        uint64_t offset = 0U;
+        uint64_t length = 0U;
+        if ((op == 'C' && !read_u64(delta.get(), offset)) || !read_u64(delta.get(), length))
+        {
+            return this->fail(Result::FORMAT_INVALID, "delta operation incomplete");
+        }
+        if ((op != 'C' && op != 'A') || length > this->target_length - written ||
+            (op == 'C' && (offset > this->source_length || length > this->source_length - offset)))
+        {
+            return this->fail(Result::FORMAT_INVALID, "delta operation out of range at target offset " + std::to_string(written));
+        }
+
+        while (length > 0U)
+        {
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(BLOCK, length));
+            const bool read_ok = (op == 'C')
+                ? read_exact(source.get(), buffer.data(), chunk, static_cast<int64_t>(offset))
+                : read_exact(delta.get(), buffer.data(), chunk);
+            if (!read_ok)
+            {
+                return (op == 'A' && errno == 0)
+                    ? this->fail(Result::FORMAT_INVALID, "delta literal truncated")
+                    : this->fail(Result::IO_FAILED, "reading delta input");
+            }
+            if (!out.write(buffer.data(), chunk))
+            {
+                return this->fail(Result::IO_FAILED, "writing " + out.path());
+            }
+            hash->update(buffer.data(), chunk);
+            (op == 'C' ? this->copied_bytes : this->literal_bytes) += chunk;
+            written += chunk;
+            offset += chunk;
+            length -= chunk;
+        }
+    }
+
+    if (written != this->target_length || finish(*hash) != target_digest)
+    {
+        return this->fail(Result::TARGET_MISMATCH, "rebuilt update does not match the delta target");
+    }
+    return Result::APPLIED;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cli
+{
+    class SpoolFile;
+
+    /**
+     * Rebuilds an update file from a delta against the active application
+     * slot. The delta is a sequence of copy operations (a range of the slot)
+     * and literal data, written by scripts/make-delta.py:
+     *
+     *   "FSDELTA1"
+     *   u64 source size, 32 byte SHA-256 of the source
+     *   u64 target size, 32 byte SHA-256 of the target
+     *   { 'C' u64 offset u64 length | 'A' u64 length <bytes> }* 'E'
+     *
+     * Integers are little endian. The slot is hashed before anything is
+     * written, the rebuilt file while it is written; both must match. The
+     * result is an ordinary update file (signed application image or .fs
+     * bundle), so fs-updater-lib verifies its signature as usual.
+     * Memory use is one copy buffer, independent of the image size.
+     */
+    class DeltaPatch
+    {
+        public:
+            enum class Result
+            {
+                APPLIED,
+                SOURCE_MISMATCH,    ///< Slot does not hold the image the delta was made against
+                TARGET_MISMATCH,    ///< Rebuilt file has the wrong size or digest
+                FORMAT_INVALID,     ///< Not a delta or an operation out of range
+                IO_FAILED           ///< Read or write error (errno in error())
+            };
+
+            /**
+             * @param path File to check.
+             * @return true if the file starts with the delta magic.
+             */
+            static bool is_delta(const std::string &path);
+
+            /**
+             * @param delta Delta file.
+             * @param source Active application slot (device or image file).
+             */
+            DeltaPatch(std::string delta, std::string source);
+
+            /**
+             * Verify the source, rebuild the target into out and verify it.
+             * @param out Spool file receiving the target; finish() is left to the caller.
+             * @return Result, details in error().
+             */
+            Result apply(SpoolFile &out);
+
+            const std::string &error() const { return this->message; }
+
+            uint64_t source_size() const { return this->source_length; }
+            uint64_t target_size() const { return this->target_length; }
+            uint64_t copied() const { return this->copied_bytes; }    ///< Bytes taken from the slot
+            uint64_t literal() const { return this->literal_bytes; }  ///< Bytes carried in the delta
+
+        private:
+            std::string delta_path;
+            std::string source_path;
+            std::string message;
+            uint64_t source_length{0};
+            uint64_t target_length{0};
+            uint64_t copied_bytes{0};
+            uint64_t literal_bytes{0};
+
+            Result fail(Result result, const std::string &reason);
+    };
+}
@@ -0,0 +1,396 @@
+#include "EnvSnapshot.h"
+#include "posix_helpers.h"
+#include "Tracer.h"
+#include "config.h"
+
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using std::string;
+
+#if FUS_CLI_ENV_CACHE
+namespace
+{
+    constexpr uint32_t CACHE_MAGIC = 0x43455346U; /* "FSEC" */
+    constexpr uint32_t CACHE_FORMAT = 1U;
+
+    constexpr char CACHE_FILE[] = "env.cache";
+    constexpr char GENERATION_FILE[] = "env.generation";
+
+    /* Fixed layout; the CRC covers every byte before the crc member. */
+    struct CacheRecord
+    {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t generation;
+        char boot_id[40];
+        uint32_t valid;
+        int32_t state;
+        uint8_t complete_fw;
+        uint8_t complete_app;
+        uint8_t rollback_pending;
+        char update_variable[16];
+        char fw_version[64];
+        char app_version[64];
+        uint32_t crc;
+    };
+
+    uint32_t record_crc(const CacheRecord &record)
+    {
+        return static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(&record),
+                                             static_cast<uInt>(offsetof(CacheRecord, crc))));
+    }
+
+    /* /run is cleared on reboot; the boot id also rejects a cache copied across boots. */
+    bool read_boot_id(char (&out)[40])
+    {
+        string boot_id;
+        if (!posix_helpers::read_file("/proc/sys/kernel/random/boot_id", boot_id) ||
+            boot_id.size() >= sizeof(out))
+        {
+            return false;
+        }
+        std::memset(out, 0, sizeof(out));
+        std::memcpy(out, boot_id.data(), boot_id.size());
+        return true;
+    }
+
+    bool copy_field(char *dst, size_t size, const string &src)
+    {
+        if (src.size() >= size)
+        {
+            return false;
+        }
+        std::memcpy(dst, src.data(), src.size());
+        return true;
+    }
+
+    uint64_t read_generation(int fd)
+    {
+        uint64_t value = 0;
+        if (::pread(fd, &value, sizeof(value), 0) != static_cast<ssize_t>(sizeof(value)))
+        {
+            return 0;
+        }
+        return value;
+    }
+
+    /* Opens and exclusively locks the generation file; the lock is released on close. */
+    int lock_generation()
+    {
+        if (::mkdir(FUS_CLI_RUN_DIR, 0700) != 0 && errno != EEXIST)
+        {
+            return -1;
+        }
+        const string path = posix_helpers::path_join(FUS_CLI_RUN_DIR, GENERATION_FILE);
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (::flock(fd, LOCK_EX) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+#endif
+
+cli::EnvSnapshot::EnvSnapshot(UpdaterProvider updater_provider, UBootProvider uboot_provider)
+    : updater(std::move(updater_provider)), uboot(std::move(uboot_provider))
+{
+}
+
+cli::EnvSnapshot::~EnvSnapshot()
+{
+    this->store();
+}
+
+// ---------------------------------------------------------------------------
+// Queries
+// ---------------------------------------------------------------------------
+
+update_definitions::UBootBootstateFlags cli::EnvSnapshot::reboot_state()
+{
+    this->load();
+    if ((this->valid & REBOOT_STATE) == 0U)
+    {
+        FSCLI_TRACE_SPAN("get_update_reboot_state");
+        fs::FSUpdate &updater = this->updater();
+        const auto start = std::chrono::steady_clock::now();
+        this->state = updater.get_update_reboot_state();
+        this->count_read(start);
+        this->valid |= REBOOT_STATE;
+        this->dirty = true;
+    }
+    return this->state;
+}
+
+bool cli::EnvSnapshot::reboot_complete(bool firmware)
+{
+    this->load();
+    const Field field = firmware ? REBOOT_COMPLETE_FW : REBOOT_COMPLETE_APP;
+    bool &value = firmware ? this->complete_fw : this->complete_app;
+    if ((this->valid & field) == 0U)
+    {
+        fs::FSUpdate &updater = this->updater();
+        const auto start = std::chrono::steady_clock::now();
+        value = updater.is_reboot_complete(firmware);
+        this->count_read(start);
+        this->valid |= field;
+        this->dirty = true;
+    }
+    return value;
+}
+
+bool cli::EnvSnapshot::pending_rollback()
+{
+    this->load();
+    if ((this->valid & PENDING_ROLLBACK) == 0U)
+    {
+        fs::FSUpdate &updater = this->updater();
+        const auto start = std::chrono::steady_clock::now();
+        this->rollback_pending = updater.pendingUpdateRollback();
+        this->count_read(start);
+        this->valid |= PENDING_ROLLBACK;
+        this->dirty = true;
+    }
+    return this->rollback_pending;
+}
+
+const string &cli::EnvSnapshot::firmware_version()
+{
+    this->load();
+    if ((this->valid & FW_VERSION) == 0U)
+    {
+        fs::FSUpdate &updater = this->updater();
+        const auto start = std::chrono::steady_clock::now();
+#if UPDATE_VERSION_TYPE_UINT64
+        this->fw_version = std::to_string(updater.get_firmware_version());
+#else
+        this->fw_version = updater.get_firmware_version();
+#endif
+        this->count_read(start);
+        this->valid |= FW_VERSION;
+        this->dirty = true;
+    }
+    return this->fw_version;
+}
+
+const string &cli::EnvSnapshot::application_version()
+{
+    this->load();
+    if ((this->valid & APP_VERSION) == 0U)
+    {
+        fs::FSUpdate &updater = this->updater();
+        const auto start = std::chrono::steady_clock::now();
+#if UPDATE_VERSION_TYPE_UINT64
+        this->app_version = std::to_string(updater.get_application_version());
+#else
+        this->app_version = updater.get_application_version();
+#endif
+        this->count_read(start);
+        this->valid |= APP_VERSION;
+        this->dirty = true;
+    }
+    return this->app_version;
+}
+
+bool cli::EnvSnapshot::slot_bad(char slot, bool application)
+{
+    this->load();
+    if ((this->valid & UPDATE_VARIABLE) == 0U)
+    {
+        UBoot::UBoot &uboot = this->uboot();
+        const auto start = std::chrono::steady_clock::now();
+        this->update_variable = uboot.getVariable("update");
+        this->count_read(start);
+        this->valid |= UPDATE_VARIABLE;
+        this->dirty = true;
+    }
+
+    /* "update" holds one state char per slot: [0]=FW_A, [1]=APP_A, [2]=FW_B, [3]=APP_B.
+     * '2' marks a slot bad.
+     */
+    const string::size_type index = ((slot == 'b' || slot == 'B') ? 2U : 0U) + (application ? 1U : 0U);
+    return (index < this->update_variable.size()) && (this->update_variable[index] == '2');
+}
+
+uint64_t cli::EnvSnapshot::elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+/* The backend is constructed before the clock starts; only the access counts. */
+void cli::EnvSnapshot::count_read(std::chrono::steady_clock::time_point start)
+{
+    this->spent.reads++;
+    this->spent.read_ns += elapsed_ns(start);
+}
+
+void cli::EnvSnapshot::count_write(std::chrono::steady_clock::time_point start)
+{
+    this->spent.writes++;
+    this->spent.write_ns += elapsed_ns(start);
+}
+
+// ---------------------------------------------------------------------------
+// Cache lifecycle
+// ---------------------------------------------------------------------------
+
+void cli::EnvSnapshot::clear()
+{
+    this->store();
+    this->loaded = false;
+    this->valid = 0U;
+}
+
+void cli::EnvSnapshot::invalidate()
+{
+    this->loaded = false;
+    this->dirty = false;
+    this->valid = 0U;
+
+#if FUS_CLI_ENV_CACHE
+    /* Bumping the generation also rejects a cache written concurrently by a
+     * reader that loaded the environment before this write.
+     */
+    const int fd = lock_generation();
+    if (fd < 0)
+    {
+        return;
+    }
+    const uint64_t next = read_generation(fd) + 1U;
+    static_cast<void>(::pwrite(fd, &next, sizeof(next), 0));
+    static_cast<void>(posix_helpers::remove_file(
+        posix_helpers::path_join(FUS_CLI_RUN_DIR, CACHE_FILE).c_str()));
+    ::close(fd);
+#endif
+}
+
+void cli::EnvSnapshot::load()
+{
+    if (this->loaded)
+    {
+        return;
+    }
+    this->loaded = true;
+    this->dirty = false;
+
+#if FUS_CLI_ENV_CACHE
+    const string gen_path = posix_helpers::path_join(FUS_CLI_RUN_DIR, GENERATION_FILE);
+    const int gen_fd = ::open(gen_path.c_str(), O_RDONLY | O_CLOEXEC);
+    this->generation = 0;
+    if (gen_fd >= 0)
+    {
+        this->generation = read_generation(gen_fd);
+        ::close(gen_fd);
+    }
+
+    const string cache_path = posix_helpers::path_join(FUS_CLI_RUN_DIR, CACHE_FILE);
+    const int fd = ::open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    CacheRecord record{};
+    const ssize_t n = ::read(fd, &record, sizeof(record));
+    ::close(fd);
+
+    char boot_id[40];
+    if (n != static_cast<ssize_t>(sizeof(record)) ||
+        record.magic != CACHE_MAGIC || record.format != CACHE_FORMAT ||
+        record.crc != record_crc(record) ||
+        record.generation != this->generation ||
+        !read_boot_id(boot_id) || std::memcmp(boot_id, record.boot_id, sizeof(boot_id)) != 0)
+    {
+        return;
+    }
+
+    /* Terminate defensively; the CRC only proves the file is what we wrote. */
+    record.update_variable[sizeof(record.update_variable) - 1] = '\0';
+    record.fw_version[sizeof(record.fw_version) - 1] = '\0';
+    record.app_version[sizeof(record.app_version) - 1] = '\0';
+
+    this->valid = record.valid;
+    this->state = static_cast<update_definitions::UBootBootstateFlags>(record.state);
+    this->complete_fw = record.complete_fw != 0U;
+    this->complete_app = record.complete_app != 0U;
+    this->rollback_pending = record.rollback_pending != 0U;
+    this->update_variable = record.update_variable;
+    this->fw_version = record.fw_version;
+    this->app_version = record.app_version;
+#endif
+}
+
+void cli::EnvSnapshot::store()
+{
+#if FUS_CLI_ENV_CACHE
+    if (!this->dirty)
+    {
+        return;
+    }
+    this->dirty = false;
+
+    CacheRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.magic = CACHE_MAGIC;
+    record.format = CACHE_FORMAT;
+    record.generation = this->generation;
+    record.valid = this->valid;
+    record.state = static_cast<int32_t>(this->state);
+    record.complete_fw = this->complete_fw ? 1U : 0U;
+    record.complete_app = this->complete_app ? 1U : 0U;
+    record.rollback_pending = this->rollback_pending ? 1U : 0U;
+
+    /* Values that do not fit are simply not cached. */
+    if (!copy_field(record.update_variable, sizeof(record.update_variable), this->update_variable))
+    {
+        record.valid &= ~static_cast<uint32_t>(UPDATE_VARIABLE);
+    }
+    if (!copy_field(record.fw_version, sizeof(record.fw_version), this->fw_version))
+    {
+        record.valid &= ~static_cast<uint32_t>(FW_VERSION);
+    }
+    if (!copy_field(record.app_version, sizeof(record.app_version), this->app_version))
+    {
+        record.valid &= ~static_cast<uint32_t>(APP_VERSION);
+    }
+    if (!read_boot_id(record.boot_id))
+    {
+        return;
+    }
+    record.crc = record_crc(record);
+
+    const int gen_fd = lock_generation();
+    if (gen_fd < 0)
+    {
+        return;
+    }
+    /* A write since load() makes the values stale. */
+    if (read_generation(gen_fd) == this->generation)
+    {
+        const string cache_path = posix_helpers::path_join(FUS_CLI_RUN_DIR, CACHE_FILE);
+        const string tmp_path = cache_path + ".tmp";
+        const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd >= 0)
+        {
+            const bool written = ::write(fd, &record, sizeof(record)) == static_cast<ssize_t>(sizeof(record));
+            ::close(fd);
+            if (!written || ::rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+            {
+                static_cast<void>(posix_helpers::remove_file(tmp_path.c_str()));
+            }
+        }
+    }
+    ::close(gen_fd);
+#endif
+}
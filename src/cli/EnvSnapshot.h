@@ -0,0 +1,153 @@
+#pragma once
+
+#include <fs_update_framework/handle_update/fsupdate.h>
+#include <fs_update_framework/uboot_interface/UBoot.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <cstdint>
+
+namespace cli
+{
+    /**
+     * Snapshot of the U-Boot environment values queried by the CLI.
+     * Every value is read at most once and then served from memory.
+     * With FUS_CLI_ENV_CACHE the snapshot is also kept in a cache file under
+     * FUS_CLI_RUN_DIR, checked by CRC, boot id and write generation, so
+     * back-to-back read-only invocations do not touch the environment storage.
+     * Each write to the environment must be followed by invalidate().
+     */
+    class EnvSnapshot
+    {
+        public:
+            using UpdaterProvider = std::function<fs::FSUpdate &()>;
+            using UBootProvider = std::function<UBoot::UBoot &()>;
+
+            /**
+             * Backends are only requested on a snapshot miss.
+             * @param updater Returns the fs::FSUpdate instance, constructing it if needed.
+             * @param uboot Returns the U-Boot environment handler, constructing it if needed.
+             */
+            EnvSnapshot(UpdaterProvider updater, UBootProvider uboot);
+
+            /**
+             * Persist values read during this process to the cache file.
+             */
+            ~EnvSnapshot();
+
+            EnvSnapshot(const EnvSnapshot &) = delete;
+            EnvSnapshot &operator=(const EnvSnapshot &) = delete;
+
+            update_definitions::UBootBootstateFlags reboot_state();
+
+            /**
+             * @param firmware Argument passed to fs::FSUpdate::is_reboot_complete().
+             */
+            bool reboot_complete(bool firmware);
+
+            bool pending_rollback();
+
+            /**
+             * @return Firmware version, formatted for output.
+             */
+            const std::string &firmware_version();
+
+            /**
+             * @return Application version, formatted for output.
+             */
+            const std::string &application_version();
+
+            /**
+             * Bad flag of a slot from the U-Boot "update" variable.
+             * @param state Slot A or B.
+             * @param application true for the application, false for the firmware slot.
+             * @return true if the slot is marked bad.
+             */
+            bool slot_bad(char state, bool application);
+
+            /**
+             * Environment accesses of this process, for the metrics file.
+             * Reads count snapshot misses only. Writes are timed by the caller,
+             * around the fs::FSUpdate calls that only change the environment.
+             */
+            struct Latency
+            {
+                uint64_t reads{0};
+                uint64_t read_ns{0};
+                uint64_t writes{0};
+                uint64_t write_ns{0};
+            };
+
+            const Latency &latency() const { return this->spent; }
+
+            /**
+             * @param start Time the environment write began.
+             */
+            void count_write(std::chrono::steady_clock::time_point start);
+
+            /**
+             * Persist and drop the in-memory values. The next query re-reads the
+             * cache file or the environment. Used between daemon and batch requests.
+             */
+            void clear();
+
+            /**
+             * Drop the in-memory values and the cache file after the environment was written.
+             */
+            void invalidate();
+
+            /**
+             * Invalidates the snapshot when leaving the scope of a write,
+             * including exits by exception after a partial write.
+             */
+            class WriteScope
+            {
+                public:
+                    explicit WriteScope(EnvSnapshot &snapshot) : snapshot(snapshot) {}
+                    ~WriteScope() { this->snapshot.invalidate(); }
+
+                    WriteScope(const WriteScope &) = delete;
+                    WriteScope &operator=(const WriteScope &) = delete;
+
+                private:
+                    EnvSnapshot &snapshot;
+            };
+
+            [[nodiscard]] WriteScope write_scope() { return WriteScope(*this); }
+
+        private:
+            enum Field : uint32_t
+            {
+                REBOOT_STATE        = 1U << 0,
+                REBOOT_COMPLETE_FW  = 1U << 1,
+                REBOOT_COMPLETE_APP = 1U << 2,
+                PENDING_ROLLBACK    = 1U << 3,
+                FW_VERSION          = 1U << 4,
+                APP_VERSION         = 1U << 5,
+                UPDATE_VARIABLE     = 1U << 6
+            };
+
+            UpdaterProvider updater;
+            UBootProvider uboot;
+
+            bool loaded{false};
+            bool dirty{false};
+            uint64_t generation{0};
+            uint32_t valid{0};
+
+            update_definitions::UBootBootstateFlags state{};
+            bool complete_fw{false};
+            bool complete_app{false};
+            bool rollback_pending{false};
+            std::string fw_version;
+            std::string app_version;
+            std::string update_variable;
+            Latency spent;
+
+            static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start);
+            void count_read(std::chrono::steady_clock::time_point start);
+            void load();
+            void store();
+    };
+}
@@ -0,0 +1,74 @@
+#include "InotifyWatch.h"
+
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+
+cli::InotifyWatch::InotifyWatch()
+    : inotify_fd(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+}
+
+cli::InotifyWatch::~InotifyWatch()
+{
+    if (this->inotify_fd >= 0)
+    {
+        ::close(this->inotify_fd);
+    }
+}
+
+bool cli::InotifyWatch::valid() const
+{
+    return this->inotify_fd >= 0;
+}
+
+int cli::InotifyWatch::add(const std::string &path, uint32_t mask)
+{
+    return ::inotify_add_watch(this->inotify_fd, path.c_str(), mask);
+}
+
+void cli::InotifyWatch::remove(int wd)
+{
+    if (wd >= 0)
+    {
+        static_cast<void>(::inotify_rm_watch(this->inotify_fd, wd));
+    }
+}
+
+int cli::InotifyWatch::wait(int timeout_ms, const EventHandler &handler)
+{
+    struct pollfd pfd{};
+    pfd.fd = this->inotify_fd;
+    pfd.events = POLLIN;
+
+    const int ready = ::poll(&pfd, 1, timeout_ms);
+    if (ready <= 0)
+    {
+        return ready;
+    }
+
+    /* Large enough for several events with NAME_MAX names. */
+    alignas(struct inotify_event) char buffer[4096];
+    int count = 0;
+    for (;;)
+    {
+        const ssize_t n = ::read(this->inotify_fd, buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            if (errno == EINTR) { continue; }
+            /* EAGAIN: queue drained */
+            return (errno == EAGAIN) ? count : -1;
+        }
+
+        for (ssize_t offset = 0; offset < n;)
+        {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+            if (handler)
+            {
+                handler(*event);
+            }
+            ++count;
+            offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <sys/inotify.h>
+
+namespace cli
+{
+    /**
+     * Owns one inotify instance. Used by the watch modes to sleep until a
+     * file in the work directory changes instead of polling it.
+     */
+    class InotifyWatch
+    {
+        public:
+            using EventHandler = std::function<void(const struct inotify_event &event)>;
+
+            InotifyWatch();
+            ~InotifyWatch();
+
+            InotifyWatch(const InotifyWatch &) = delete;
+            InotifyWatch &operator=(const InotifyWatch &) = delete;
+
+            /**
+             * @return false if the inotify instance could not be created.
+             */
+            bool valid() const;
+
+            /**
+             * Watch a file or directory. Adding a watched path again replaces its mask.
+             * @param path Path to watch.
+             * @param mask IN_* event mask.
+             * @return Watch descriptor, -1 on error (errno set).
+             */
+            int add(const std::string &path, uint32_t mask);
+
+            /**
+             * Stop watching; ignores descriptors the kernel already removed.
+             * @param wd Watch descriptor returned by add().
+             */
+            void remove(int wd);
+
+            /**
+             * Wait for events and pass each one to handler.
+             * @param timeout_ms Maximum wait, negative to wait without limit.
+             * @param handler Called per event, may be empty.
+             * @return Number of events read, 0 on timeout, -1 on error (EINTR included).
+             */
+            int wait(int timeout_ms, const EventHandler &handler);
+
+        private:
+            int inotify_fd{-1};
+    };
+}
@@ -0,0 +1,252 @@
+#include "Metrics.h"
+#include "OutputReport.h"
+#include "fs_updater_error.h"
+#include "posix_helpers.h"
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace
+{
+    constexpr char METRICS_FILE[] = "fs_updater.prom";
+
+    struct MetricInfo
+    {
+        const char *name;
+        const char *type;
+        const char *help;
+    };
+
+    /* Only these names are written; anything else in an old file is dropped. */
+    constexpr std::array<MetricInfo, 14> METRICS = {{
+        {"fs_updater_attempts_total", "counter", "Runs of a state-changing command."},
+        {"fs_updater_failures_total", "counter", "Failed runs, by exit code category and state."},
+        {"fs_updater_last_result_code", "gauge", "Exit code of the last run."},
+        {"fs_updater_last_run_timestamp_seconds", "gauge", "Unix time the last run finished."},
+        {"fs_updater_install_duration_seconds", "gauge", "Duration of the last completed update_image() call."},
+        {"fs_updater_install_bytes", "gauge", "Size of the update file of the last completed install."},
+        {"fs_updater_install_throughput_bytes_per_second", "gauge", "Update file bytes per second of the last completed install."},
+        {"fs_updater_spool_written_bytes", "gauge", "Bytes written to the spool file of the last streamed install."},
+        {"fs_updater_verify_duration_seconds", "gauge", "Duration of the last bundle verification."},
+        {"fs_updater_verify_bytes", "gauge", "Bundle bytes read by the last verification."},
+        {"fs_updater_env_reads", "gauge", "U-Boot environment reads of the last run."},
+        {"fs_updater_env_read_seconds", "gauge", "Time spent in U-Boot environment reads of the last run."},
+        {"fs_updater_env_writes", "gauge", "U-Boot environment writes of the last run."},
+        {"fs_updater_env_write_seconds", "gauge", "Time spent in U-Boot environment writes of the last run."},
+    }};
+
+    /* Exit codes the state-changing commands report on success. */
+    constexpr std::array<int, 8> SUCCESS_CODES = {{
+        static_cast<int>(UPDATER_FIRMWARE_STATE::UPDATE_SUCCESSFUL),
+        static_cast<int>(UPDATER_APPLICATION_STATE::UPDATE_SUCCESSFUL),
+        static_cast<int>(UPDATER_FIRMWARE_AND_APPLICATION_STATE::UPDATE_SUCCESSFUL),
+        static_cast<int>(UPDATER_UPDATE_ROLLBACK_STATE::UPDATE_ROLLBACK_SUCCESSFUL),
+        static_cast<int>(UPDATER_COMMIT_STATE::UPDATE_COMMIT_SUCCESSFUL),
+        static_cast<int>(UPDATER_COMMIT_STATE::UPDATE_NOT_NEEDED),
+        static_cast<int>(UPDATER_APPLY_UPDATE_STATE::APPLY_SUCCESSFUL),
+        static_cast<int>(UPDATER_VERIFY_STATE::VERIFY_SUCCESSFUL),
+    }};
+
+    bool failed(int code)
+    {
+        return std::find(SUCCESS_CODES.begin(), SUCCESS_CODES.end(), code) == SUCCESS_CODES.end();
+    }
+
+    /* Metric name of a series, without labels. */
+    string series_name(const string &series)
+    {
+        return series.substr(0, series.find('{'));
+    }
+
+    bool known(const string &name)
+    {
+        return std::any_of(METRICS.begin(), METRICS.end(),
+            [&name](const MetricInfo &info) { return name == info.name; });
+    }
+
+    /* "series value" lines; comments and unknown names are skipped. */
+    void parse(const string &text, std::map<string, double> &samples)
+    {
+        string::size_type start = 0;
+        while (start < text.size())
+        {
+            string::size_type end = text.find('\n', start);
+            if (end == string::npos)
+            {
+                end = text.size();
+            }
+            const string line = text.substr(start, end - start);
+            start = end + 1;
+
+            const string::size_type space = line.rfind(' ');
+            if (line.empty() || line.front() == '#' || space == string::npos)
+            {
+                continue;
+            }
+            const string series = line.substr(0, space);
+            if (known(series_name(series)))
+            {
+                samples[series] = std::strtod(line.c_str() + space + 1, nullptr);
+            }
+        }
+    }
+
+    string render(const std::map<string, double> &samples)
+    {
+        string text;
+        char value[32];
+        for (const auto &info : METRICS)
+        {
+            bool header = false;
+            for (const auto &sample : samples)
+            {
+                if (series_name(sample.first) != info.name)
+                {
+                    continue;
+                }
+                if (!header)
+                {
+                    text += string("# HELP ") + info.name + " " + info.help + "\n";
+                    text += string("# TYPE ") + info.name + " " + info.type + "\n";
+                    header = true;
+                }
+                static_cast<void>(std::snprintf(value, sizeof(value), "%.15g", sample.second));
+                text += sample.first + " " + value + "\n";
+            }
+        }
+        return text;
+    }
+}
+
+cli::Metrics::Metrics(string command)
+    : command(std::move(command))
+{
+}
+
+bool cli::Metrics::enabled()
+{
+    return FUS_CLI_METRICS_DIR[0] != '\0';
+}
+
+void cli::Metrics::set(const char *name, double value)
+{
+    for (auto &gauge : this->gauges)
+    {
+        if (string(gauge.first) == name)
+        {
+            gauge.second = value;
+            return;
+        }
+    }
+    this->gauges.emplace_back(name, value);
+}
+
+bool cli::Metrics::write(int code)
+{
+    const string path = posix_helpers::path_join(FUS_CLI_METRICS_DIR, METRICS_FILE);
+    const string tmp_path = path + ".tmp";
+
+    /* Serializes read-modify-write between processes; the collector only reads *.prom. */
+    const int lock_fd = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0)
+    {
+        return false;
+    }
+    if (::flock(lock_fd, LOCK_EX) != 0)
+    {
+        const int error = errno;
+        ::close(lock_fd);
+        errno = error;
+        return false;
+    }
+
+    std::map<string, double> samples;
+    string text;
+    if (posix_helpers::read_file(path.c_str(), text))
+    {
+        parse(text, samples);
+    }
+
+    const string labels = "command=\"" + this->command + "\"";
+    if (!this->attempt_counted)
+    {
+        samples["fs_updater_attempts_total{" + labels + "}"] += 1.0;
+        this->attempt_counted = true;
+    }
+    if (failed(code) && !this->failure_counted)
+    {
+        const char *category = "UNKNOWN";
+        const char *state = "UNKNOWN";
+        static_cast<void>(OutputReport::lookup(code, category, state));
+        samples["fs_updater_failures_total{" + labels + ",category=\"" + category + "\",state=\"" + state + "\"}"] += 1.0;
+        this->failure_counted = true;
+    }
+    samples["fs_updater_last_result_code{" + labels + "}"] = static_cast<double>(code);
+    samples["fs_updater_last_run_timestamp_seconds{" + labels + "}"] = static_cast<double>(std::time(nullptr));
+    for (const auto &gauge : this->gauges)
+    {
+        samples[string(gauge.first) + "{" + labels + "}"] = gauge.second;
+    }
+
+    text = render(samples);
+
+    /* fsync of the file and, after the rename, of the directory:
+     * --apply_update reboots right after the write. errno is kept from the
+     * step that failed; close() and the cleanup may change it.
+     */
+    int error = 0;
+    const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error = errno;
+    }
+    else
+    {
+        const ssize_t n = ::write(fd, text.data(), text.size());
+        if (n != static_cast<ssize_t>(text.size()))
+        {
+            error = (n < 0) ? errno : ENOSPC;
+        }
+        else if (::fsync(fd) != 0)
+        {
+            error = errno;
+        }
+        ::close(fd);
+    }
+    if (error == 0 && ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        error = errno;
+    }
+    if (error != 0)
+    {
+        static_cast<void>(posix_helpers::remove_file(tmp_path.c_str()));
+    }
+    else
+    {
+        const int dir_fd = ::open(FUS_CLI_METRICS_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0 || ::fsync(dir_fd) != 0)
+        {
+            error = errno;
+        }
+        if (dir_fd >= 0)
+        {
+            ::close(dir_fd);
+        }
+    }
+
+    ::close(lock_fd);
+    errno = error;
+    return error == 0;
+}
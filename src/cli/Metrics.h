@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cli
+{
+    /**
+     * Update health for the node_exporter textfile collector. After each
+     * state-changing command the CLI merges its values into fs_updater.prom
+     * in FUS_CLI_METRICS_DIR and replaces the file by rename, so the
+     * collector never reads a partial file. Counters of earlier runs are
+     * read back from that file; if it is removed they restart at zero,
+     * which Prometheus handles as a counter reset.
+     */
+    class Metrics
+    {
+        public:
+            /**
+             * @param command Action flag without dashes; the "command" label of every series.
+             */
+            explicit Metrics(std::string command);
+
+            /**
+             * @return false if the build has no FUS_CLI_METRICS_DIR.
+             */
+            static bool enabled();
+
+            /**
+             * Set a gauge of this command, written with the next write().
+             * @param name Gauge name from the table in Metrics.cpp.
+             * @param value Value in base units (seconds, bytes).
+             */
+            void set(const char *name, double value);
+
+            /**
+             * Merge this command into the metrics file. May be called again
+             * with a later exit code; attempts and failures are counted once.
+             * @param code Exit code of the command.
+             * @return false if the file could not be written (errno set).
+             */
+            bool write(int code);
+
+        private:
+            std::string command;
+            std::vector<std::pair<const char *, double>> gauges;
+            bool attempt_counted{false};
+            bool failure_counted{false};
+    };
+}
@@ -0,0 +1,207 @@
+#include "OutputReport.h"
+#include "fs_updater_error.h"
+#include "cli_io.h"
+
+#include <array>
+
+using std::string;
+
+namespace
+{
+    struct CodeName
+    {
+        int code;
+        const char *category;
+        const char *state;
+    };
+
+    /* Codes from here on are the CLI's own and mean the same for every command. */
+    constexpr int FIRST_CLI_CODE = static_cast<int>(UPDATER_CLI_VALIDATION::INVALID_UPDATE_TYPE);
+
+    /* Sorted by code; same order as fs_updater_error.h. */
+    constexpr std::array<CodeName, 82> CODE_NAMES = {{
+        {0,   "UPDATER_FIRMWARE_STATE", "UPDATE_SUCCESSFUL"},
+        {1,   "UPDATER_FIRMWARE_STATE", "UPDATE_PROGRESS_ERROR"},
+        {2,   "UPDATER_FIRMWARE_STATE", "UPDATE_INTERNAL_ERROR"},
+        {3,   "UPDATER_FIRMWARE_STATE", "UPDATE_SYSTEM_ERROR"},
+        {4,   "UPDATER_APPLICATION_STATE", "UPDATE_SUCCESSFUL"},
+        {5,   "UPDATER_APPLICATION_STATE", "UPDATE_PROGRESS_ERROR"},
+        {6,   "UPDATER_APPLICATION_STATE", "UPDATE_INTERNAL_ERROR"},
+        {7,   "UPDATER_APPLICATION_STATE", "UPDATE_SYSTEM_ERROR"},
+        {8,   "UPDATER_FIRMWARE_AND_APPLICATION_STATE", "UPDATE_SUCCESSFUL"},
+        {9,   "UPDATER_FIRMWARE_AND_APPLICATION_STATE", "UPDATE_PROGRESS_ERROR"},
+        {10,  "UPDATER_FIRMWARE_AND_APPLICATION_STATE", "UPDATE_INTERNAL_ERROR"},
+        {11,  "UPDATER_FIRMWARE_AND_APPLICATION_STATE", "UPDATE_SYSTEM_ERROR"},
+        {12,  "UPDATER_UPDATE_ROLLBACK_STATE", "UPDATE_ROLLBACK_SUCCESSFUL"},
+        {13,  "UPDATER_UPDATE_ROLLBACK_STATE", "UPDATE_ROLLBACK_PROGRESS_ERROR"},
+        {14,  "UPDATER_UPDATE_ROLLBACK_STATE", "UPDATE_ROLLBACK_INTERNAL_ERROR"},
+        {15,  "UPDATER_UPDATE_ROLLBACK_STATE", "UPDATE_ROLLBACK_SYSTEM_ERROR"},
+        {16,  "UPDATER_COMMIT_STATE", "UPDATE_COMMIT_SUCCESSFUL"},
+        {17,  "UPDATER_COMMIT_STATE", "UPDATE_NOT_NEEDED"},
+        {18,  "UPDATER_COMMIT_STATE", "UPDATE_NOT_ALLOWED_UBOOT_STATE"},
+        {19,  "UPDATER_COMMIT_STATE", "UPDATE_SYSTEM_ERROR"},
+        {20,  "UPDATER_UPDATE_REBOOT_STATE", "FAILED_APP_UPDATE"},
+        {21,  "UPDATER_UPDATE_REBOOT_STATE", "FAILED_FW_UPDATE"},
+        {22,  "UPDATER_UPDATE_REBOOT_STATE", "FW_UPDATE_REBOOT_FAILED"},
+        {23,  "UPDATER_UPDATE_REBOOT_STATE", "INCOMPLETE_FW_UPDATE"},
+        {24,  "UPDATER_UPDATE_REBOOT_STATE", "INCOMPLETE_APP_UPDATE"},
+        {25,  "UPDATER_UPDATE_REBOOT_STATE", "INCOMPLETE_APP_FW_UPDATE"},
+        {26,  "UPDATER_UPDATE_REBOOT_STATE", "UPDATE_REBOOT_PENDING"},
+        {27,  "UPDATER_UPDATE_REBOOT_STATE", "NO_UPDATE_REBOOT_PENDING"},
+        {28,  "UPDATER_UPDATE_REBOOT_STATE", "ROLLBACK_FW_REBOOT_PENDING"},
+        {29,  "UPDATER_UPDATE_REBOOT_STATE", "ROLLBACK_APP_REBOOT_PENDING"},
+        {30,  "UPDATER_UPDATE_REBOOT_STATE", "ROLLBACK_APP_FW_REBOOT_PENDING"},
+        {31,  "UPDATER_UPDATE_REBOOT_STATE", "INCOMPLETE_FW_ROLLBACK"},
+        {32,  "UPDATER_UPDATE_REBOOT_STATE", "INCOMPLETE_APP_ROLLBACK"},
+        {33,  "UPDATER_UPDATE_REBOOT_STATE", "INCOMPLETE_APP_FW_ROLLBACK"},
+        {34,  "UPDATER_IS_UPDATE_AVAILABLE_STATE", "NO_UPDATE_AVAILABLE"},
+        {35,  "UPDATER_IS_UPDATE_AVAILABLE_STATE", "FIRMWARE_UPDATE_AVAILABLE"},
+        {36,  "UPDATER_IS_UPDATE_AVAILABLE_STATE", "APPLICATION_UPDATE_AVAILABLE"},
+        {37,  "UPDATER_IS_UPDATE_AVAILABLE_STATE", "FIRMWARE_AND_APPLICATION_UPDATE_AVAILABLE"},
+        {38,  "UPDATER_DOWNLOAD_UPDATE_STATE", "NO_DOWNLOAD_QUEUED"},
+        {39,  "UPDATER_DOWNLOAD_UPDATE_STATE", "UPDATE_DOWNLOAD_STARTED"},
+        {40,  "UPDATER_DOWNLOAD_UPDATE_STATE", "UPDATE_DOWNLOAD_STARTED_BEFORE"},
+        {41,  "UPDATER_DOWNLOAD_UPDATE_STATE", "UPDATE_DOWNLOAD_FAILED"},
+        {42,  "UPDATER_DOWNLOAD_PROGRESS_STATE", "NO_DOWNLOAD_STARTED"},
+        {43,  "UPDATER_DOWNLOAD_PROGRESS_STATE", "UPDATE_DOWNLOAD_WAITING_TO_START"},
+        {44,  "UPDATER_DOWNLOAD_PROGRESS_STATE", "UPDATE_DOWNLOAD_IN_PROGRESS"},
+        {45,  "UPDATER_DOWNLOAD_PROGRESS_STATE", "UPDATE_DOWNLOAD_FINISHED"},
+        {46,  "UPDATER_INSTALL_UPDATE_STATE", "NO_INSTALLATION_QUEUED"},
+        {47,  "UPDATER_INSTALL_UPDATE_STATE", "UPDATE_INSTALLATION_IN_PROGRESS"},
+        {48,  "UPDATER_INSTALL_UPDATE_STATE", "UPDATE_INSTALLATION_FINISHED"},
+        {49,  "UPDATER_INSTALL_UPDATE_STATE", "UPDATE_INSTALLATION_FAILED"},
+        {50,  "UPDATER_APPLY_UPDATE_STATE", "APPLY_SUCCESSFUL"},
+        {51,  "UPDATER_APPLY_UPDATE_STATE", "APPLY_FAILED"},
+        {52,  "UPDATER_SETGET_UPDATE_STATE", "GETSET_STATE_SUCCESSFUL"},
+        {53,  "UPDATER_SETGET_UPDATE_STATE", "PASSING_PARAM_UPDATE_STATE_WRONG"},
+        {54,  "UPDATER_SETGET_UPDATE_STATE", "UPDATE_STATE_BAD"},
+        {60,  "UPDATER_CLI_VALIDATION", "INVALID_UPDATE_TYPE"},
+        {61,  "UPDATER_CLI_VALIDATION", "UPDATE_FILE_NOT_FOUND"},
+        {62,  "UPDATER_CLI_VALIDATION", "MISSING_ENV_UPDATE_STICK"},
+        {63,  "UPDATER_CLI_VALIDATION", "MISSING_ENV_UPDATE_FILE"},
+        {64,  "UPDATER_CLI_VALIDATION", "UPDATE_TYPE_WITHOUT_FILE"},
+        {65,  "UPDATER_CLI_VALIDATION", "INCOMPATIBLE_ARG_COMBO"},
+        {66,  "UPDATER_CLI_VALIDATION", "BATCH_FILE_NOT_FOUND"},
+        {67,  "UPDATER_CLI_VALIDATION", "MODIFIER_WITHOUT_ACTION"},
+        {68,  "UPDATER_CLI_VALIDATION", "INVALID_RESOURCE_LIMIT"},
+        {70,  "UPDATER_SYSTEM", "REBOOT_FAILED"},
+        {71,  "UPDATER_SYSTEM", "DAEMON_UNAVAILABLE"},
+        {72,  "UPDATER_SYSTEM", "DAEMON_SOCKET_FAILED"},
+        {73,  "UPDATER_SYSTEM", "WATCH_FAILED"},
+        {74,  "UPDATER_SYSTEM", "UPDATE_STREAM_FAILED"},
+        {75,  "UPDATER_WAIT_STATE", "SIGNAL_PRESENT"},
+        {76,  "UPDATER_WAIT_STATE", "WAIT_TIMED_OUT"},
+        {77,  "UPDATER_WAIT_STATE", "WORK_DIR_REMOVED"},
+        {78,  "UPDATER_WAIT_STATE", "INVALID_SIGNAL"},
+        {80,  "UPDATER_VERIFY_STATE", "VERIFY_SUCCESSFUL"},
+        {81,  "UPDATER_VERIFY_STATE", "VERIFY_MISMATCH"},
+        {82,  "UPDATER_VERIFY_STATE", "VERIFY_MANIFEST_INVALID"},
+        {83,  "UPDATER_VERIFY_STATE", "VERIFY_READ_FAILED"},
+        {85,  "UPDATER_DELTA_STATE", "DELTA_SOURCE_MISMATCH"},
+        {86,  "UPDATER_DELTA_STATE", "DELTA_TARGET_MISMATCH"},
+        {87,  "UPDATER_DELTA_STATE", "DELTA_INVALID"},
+        {88,  "UPDATER_DELTA_STATE", "DELTA_APPLY_FAILED"},
+        {124, "UPDATER_FATAL", "UNHANDLED_EXCEPTION"},
+    }};
+}
+
+cli::OutputReport::OutputReport(bool json)
+    : capturing(json)
+{
+    if (this->capturing)
+    {
+        this->previous = cli_io::stdout_capture();
+        cli_io::stdout_capture() = &this->captured;
+    }
+}
+
+cli::OutputReport::~OutputReport()
+{
+    if (this->capturing && !this->finished)
+    {
+        cli_io::stdout_capture() = this->previous;
+    }
+}
+
+void cli::OutputReport::set_command(const string &name)
+{
+    this->root["command"] = name;
+}
+
+void cli::OutputReport::set(const char *key, const string &value)
+{
+    this->root[key] = value;
+}
+
+void cli::OutputReport::set(const char *key, const char *value)
+{
+    this->root[key] = value;
+}
+
+void cli::OutputReport::set(const char *key, bool value)
+{
+    this->root[key] = value;
+}
+
+void cli::OutputReport::set(const char *key, uint64_t value)
+{
+    this->root[key] = static_cast<Json::UInt64>(value);
+}
+
+void cli::OutputReport::set(const char *key, int64_t value)
+{
+    this->root[key] = static_cast<Json::Int64>(value);
+}
+
+string cli::OutputReport::finish(int code)
+{
+    if (!this->capturing || this->finished)
+    {
+        return string();
+    }
+    this->finished = true;
+    cli_io::stdout_capture() = this->previous;
+
+    this->root["code"] = code;
+    const char *category = nullptr;
+    const char *state = nullptr;
+    if ((this->named || code >= FIRST_CLI_CODE) && lookup(code, category, state))
+    {
+        this->root["category"] = category;
+        this->root["state"] = state;
+    }
+
+    Json::Value &messages = this->root["messages"] = Json::Value(Json::arrayValue);
+    string::size_type start = 0;
+    while (start < this->captured.size())
+    {
+        string::size_type end = this->captured.find('\n', start);
+        if (end == string::npos)
+        {
+            end = this->captured.size();
+        }
+        if (end > start)
+        {
+            messages.append(this->captured.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, this->root) + "\n";
+}
+
+bool cli::OutputReport::lookup(int code, const char *&category, const char *&state)
+{
+    for (const auto &entry : CODE_NAMES)
+    {
+        if (entry.code == code)
+        {
+            category = entry.category;
+            state = entry.state;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <json/json.h>
+
+#include <cstdint>
+#include <string>
+
+namespace cli
+{
+    /**
+     * Result of one command for --output json. Handlers add typed fields;
+     * in JSON mode the text they write to stdout is collected as well and
+     * the whole result is serialized once, as one compact line:
+     *
+     *   {"category":"UPDATER_UPDATE_REBOOT_STATE","code":27,"command":"update_reboot_state",
+     *    "messages":["No update pending"],"reboot_state_text":"No update pending",
+     *    "state":"NO_UPDATE_REBOOT_PENDING"}
+     *
+     * Reports nest: the JSON line of a batch request becomes a message of
+     * the --batch report.
+     */
+    class OutputReport
+    {
+        public:
+            /**
+             * @param json Collect stdout text until finish() and emit JSON.
+             */
+            explicit OutputReport(bool json);
+            ~OutputReport();
+
+            OutputReport(const OutputReport &) = delete;
+            OutputReport &operator=(const OutputReport &) = delete;
+
+            bool json() const { return this->capturing; }
+
+            void set_command(const std::string &name);
+
+            /**
+             * Whether the command's exit codes are enum values. Codes below 60
+             * are only named if so: --version, for example, exits 0 without
+             * meaning UPDATER_FIRMWARE_STATE::UPDATE_SUCCESSFUL. Off until set.
+             * @param enum_codes true for commands that return enum values.
+             */
+            void set_enum_codes(bool enum_codes) { this->named = enum_codes; }
+
+            void set(const char *key, const std::string &value);
+            void set(const char *key, const char *value);
+            void set(const char *key, bool value);
+            void set(const char *key, uint64_t value);
+            void set(const char *key, int64_t value);
+
+            /**
+             * Stop collecting stdout text.
+             * @param code Exit code of the command.
+             * @return JSON line in JSON mode, else an empty string.
+             */
+            std::string finish(int code);
+
+            /**
+             * Enum of an exit code, as listed in docs/reference/return-codes.md.
+             * @param code Exit code.
+             * @param category Receives the enum type, e.g. "UPDATER_VERIFY_STATE".
+             * @param state Receives the enum value, e.g. "VERIFY_MISMATCH".
+             * @return false for a code without enum.
+             */
+            static bool lookup(int code, const char *&category, const char *&state);
+
+        private:
+            bool capturing;
+            bool finished{false};
+            bool named{false};
+            Json::Value root{Json::objectValue};
+            std::string captured;
+            std::string *previous{nullptr};
+    };
+}
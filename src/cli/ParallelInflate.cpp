@@ -0,0 +1,418 @@
+#include "ParallelInflate.h"
+#include "SpoolFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <zlib.h>
+
+using std::string;
+
+namespace
+{
+    constexpr uint8_t GZIP_ID1 = 0x1fU;
+    constexpr uint8_t GZIP_ID2 = 0x8bU;
+    constexpr uint8_t GZIP_DEFLATE = 8U;
+    constexpr uint8_t GZIP_FEXTRA = 0x04U;
+    constexpr size_t GZIP_HEADER = 12U;     ///< Fixed header and XLEN
+    constexpr size_t GZIP_TRAILER = 8U;     ///< CRC32 and ISIZE
+    constexpr size_t STREAM_BLOCK = 256U * 1024U;
+    /* zlib window bits for a gzip wrapper with CRC and size check. */
+    constexpr int GZIP_WINDOW = 15 + 16;
+
+    uint32_t le32(const uint8_t *bytes)
+    {
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8U) |
+               (static_cast<uint32_t>(bytes[2]) << 16U) | (static_cast<uint32_t>(bytes[3]) << 24U);
+    }
+}
+
+/* Source descriptor with push-back, so a header read for detection can be
+ * handed to the sequential path unchanged.
+ */
+class cli::ParallelInflate::Input
+{
+    public:
+        Input(int fd, const string &prefix) : fd(fd), pending(prefix.begin(), prefix.end()) {}
+
+        /**
+         * @return Bytes read, 0 at end of input, -1 on error (errno set).
+         */
+        ssize_t read(uint8_t *buffer, size_t length)
+        {
+            if (this->next < this->pending.size())
+            {
+                const size_t take = std::min(length, this->pending.size() - this->next);
+                std::memcpy(buffer, this->pending.data() + this->next, take);
+                this->next += take;
+                return static_cast<ssize_t>(take);
+            }
+            for (;;)
+            {
+                const ssize_t n = ::read(this->fd, buffer, length);
+                if (n < 0 && errno == EINTR) { continue; }
+                return n;
+            }
+        }
+
+        /**
+         * @return Bytes read; less than length only at end of input or on error.
+         */
+        size_t read_full(uint8_t *buffer, size_t length)
+        {
+            size_t got = 0U;
+            while (got < length)
+            {
+                const ssize_t n = this->read(buffer + got, length - got);
+                if (n <= 0)
+                {
+                    this->failed = (n < 0);
+                    break;
+                }
+                got += static_cast<size_t>(n);
+            }
+            return got;
+        }
+
+        void unread(const uint8_t *data, size_t length)
+        {
+            this->pending.erase(this->pending.begin(), this->pending.begin() + static_cast<std::ptrdiff_t>(this->next));
+            this->pending.insert(this->pending.begin(), data, data + length);
+            this->next = 0U;
+        }
+
+        bool failed{false};
+
+    private:
+        int fd;
+        std::vector<uint8_t> pending;
+        size_t next{0};
+};
+
+bool cli::ParallelInflate::is_gzip(const void *head, size_t length, const string &name)
+{
+    const auto *bytes = static_cast<const uint8_t *>(head);
+    if (length < 2U || bytes[0] != GZIP_ID1 || bytes[1] != GZIP_ID2)
+    {
+        return false;
+    }
+    if (name.size() > 3U && name.compare(name.size() - 3U, 3U, ".gz") == 0)
+    {
+        return true;
+    }
+    /* BGZF: deflate, FEXTRA, XLEN 6 holding only the "BC" subfield of length 2. */
+    return length >= HEAD && bytes[2] == GZIP_DEFLATE && (bytes[3] & GZIP_FEXTRA) != 0U &&
+           bytes[10] == 6U && bytes[11] == 0U && bytes[12] == 'B' && bytes[13] == 'C' &&
+           bytes[14] == 2U && bytes[15] == 0U;
+}
+
+cli::ParallelInflate::ParallelInflate(unsigned workers, uint64_t budget)
+{
+    const unsigned threads = std::max(workers, 1U);
+    /* Each slot holds a member and its inflated data, up to MEMBER_MAX each. */
+    const uint64_t in_flight = std::max<uint64_t>(budget / (2U * MEMBER_MAX), threads);
+    this->slots.resize(static_cast<size_t>(in_flight));
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        this->pool.emplace_back(&ParallelInflate::work, this);
+    }
+}
+
+cli::ParallelInflate::~ParallelInflate()
+{
+    {
+        const std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->queued.notify_all();
+    for (auto &worker : this->pool)
+    {
+        worker.join();
+    }
+}
+
+void cli::ParallelInflate::work()
+{
+    for (;;)
+    {
+        size_t index = 0U;
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->queued.wait(guard, [this]() { return this->stopping || !this->queue.empty(); });
+            if (this->queue.empty())
+            {
+                return;
+            }
+            index = this->queue.front();
+            this->queue.pop_front();
+        }
+
+        /* A queued slot is only touched by the worker that took it. */
+        const bool ok = inflate_member(this->slots[index]);
+        {
+            const std::lock_guard<std::mutex> guard(this->lock);
+            this->slots[index].state = ok ? SlotState::READY : SlotState::FAILED;
+        }
+        this->inflated.notify_all();
+    }
+}
+
+bool cli::ParallelInflate::inflate_member(Slot &slot)
+{
+    const size_t expected = le32(slot.input.data() + slot.input.size() - 4U);
+    if (expected > MEMBER_MAX)
+    {
+        return false;
+    }
+    /* One spare byte: a member inflating to more than ISIZE is caught. */
+    slot.output.resize(expected + 1U);
+
+    z_stream stream{};
+    if (::inflateInit2(&stream, GZIP_WINDOW) != Z_OK)
+    {
+        return false;
+    }
+    stream.next_in = slot.input.data();
+    stream.avail_in = static_cast<uInt>(slot.input.size());
+    stream.next_out = slot.output.data();
+    stream.avail_out = static_cast<uInt>(slot.output.size());
+    const int status = ::inflate(&stream, Z_FINISH);
+    const bool ok = status == Z_STREAM_END && stream.avail_in == 0U && stream.total_out == expected;
+    static_cast<void>(::inflateEnd(&stream));
+    slot.output.resize(expected);
+    return ok;
+}
+
+cli::ParallelInflate::Result cli::ParallelInflate::run(int source, const string &prefix, SpoolFile &out)
+{
+    Input input(source, prefix);
+    bool sequential = false;
+    const Result result = this->run_parallel(input, out, sequential);
+    if (result != Result::DONE || !sequential)
+    {
+        return result;
+    }
+    return this->run_sequential(input, out);
+}
+
+/* Members are read on this thread into the next free slot, inflated by the
+ * pool and written strictly in input order. Reading waits only when every
+ * slot is in flight, so the source, the workers and the spool file overlap.
+ * A member without the size field leaves the rest of the input to
+ * run_sequential().
+ */
+cli::ParallelInflate::Result cli::ParallelInflate::run_parallel(Input &input, SpoolFile &out, bool &sequential)
+{
+    uint64_t read_count = 0U;
+    uint64_t write_count = 0U;
+    Result result = Result::DONE;
+
+    const auto write_next = [&](bool wait) -> bool {
+        Slot &slot = this->slots[static_cast<size_t>(write_count % this->slots.size())];
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            if (wait)
+            {
+                this->inflated.wait(guard, [&slot]() { return slot.state != SlotState::QUEUED; });
+            }
+            else if (slot.state == SlotState::QUEUED)
+            {
+                return false;
+            }
+        }
+        if (slot.state == SlotState::FAILED)
+        {
+            result = this->fail(Result::FORMAT_INVALID, "corrupt compressed member " + std::to_string(write_count));
+        }
+        else if (!out.write(slot.output.data(), slot.output.size()))
+        {
+            result = this->fail(Result::WRITE_FAILED, "writing " + out.path());
+        }
+        slot.state = SlotState::EMPTY;
+        ++write_count;
+        return result == Result::DONE;
+    };
+
+    while (result == Result::DONE)
+    {
+        /* Write what is ready, and make room if every slot is in flight. */
+        while (write_count < read_count && write_next(read_count - write_count == this->slots.size()))
+        {
+        }
+        if (result != Result::DONE)
+        {
+            break;
+        }
+
+        uint8_t header[GZIP_HEADER];
+        const size_t got = input.read_full(header, sizeof(header));
+        if (got == 0U && !input.failed)
+        {
+            break;
+        }
+        if (got < sizeof(header) || header[0] != GZIP_ID1 || header[1] != GZIP_ID2 ||
+            header[2] != GZIP_DEFLATE || (header[3] & GZIP_FEXTRA) == 0U)
+        {
+            if (input.failed)
+            {
+                result = this->fail(Result::READ_FAILED, "reading compressed update");
+                break;
+            }
+            input.unread(header, got);
+            sequential = true;
+            break;
+        }
+
+        const size_t extra_length = static_cast<size_t>(header[10]) | (static_cast<size_t>(header[11]) << 8U);
+        std::vector<uint8_t> extra(extra_length);
+        if (input.read_full(extra.data(), extra_length) < extra_length)
+        {
+            result = input.failed ? this->fail(Result::READ_FAILED, "reading compressed update")
+                                  : this->fail(Result::FORMAT_INVALID, "compressed update truncated");
+            break;
+        }
+
+        /* Subfields: SI1 SI2 LEN(2) data. BGZF stores the member size - 1 in "BC". */
+        size_t member_size = 0U;
+        for (size_t at = 0U; at + 4U <= extra_length;)
+        {
+            const size_t field_length = static_cast<size_t>(extra[at + 2U]) | (static_cast<size_t>(extra[at + 3U]) << 8U);
+            if (extra[at] == 'B' && extra[at + 1U] == 'C' && field_length == 2U && at + 6U <= extra_length)
+            {
+                member_size = (static_cast<size_t>(extra[at + 4U]) | (static_cast<size_t>(extra[at + 5U]) << 8U)) + 1U;
+                break;
+            }
+            at += 4U + field_length;
+        }
+        if (member_size == 0U)
+        {
+            input.unread(extra.data(), extra_length);
+            input.unread(header, sizeof(header));
+            sequential = true;
+            break;
+        }
+        if (member_size < GZIP_HEADER + extra_length + GZIP_TRAILER)
+        {
+            result = this->fail(Result::FORMAT_INVALID, "compressed member size out of range");
+            break;
+        }
+
+        Slot &slot = this->slots[static_cast<size_t>(read_count % this->slots.size())];
+        slot.input.resize(member_size);
+        std::memcpy(slot.input.data(), header, sizeof(header));
+        std::memcpy(slot.input.data() + sizeof(header), extra.data(), extra_length);
+        const size_t rest = member_size - sizeof(header) - extra_length;
+        if (input.read_full(slot.input.data() + sizeof(header) + extra_length, rest) < rest)
+        {
+            result = input.failed ? this->fail(Result::READ_FAILED, "reading compressed update")
+                                  : this->fail(Result::FORMAT_INVALID, "compressed update truncated");
+            break;
+        }
+
+        {
+            const std::lock_guard<std::mutex> guard(this->lock);
+            slot.state = SlotState::QUEUED;
+            this->queue.push_back(static_cast<size_t>(read_count % this->slots.size()));
+        }
+        this->queued.notify_one();
+        this->compressed_bytes += member_size;
+        ++this->member_count;
+        ++read_count;
+    }
+
+    /* Drain: queued members are finished even after an error, as the slots
+     * they use are owned by the workers until then.
+     */
+    while (write_count < read_count)
+    {
+        if (result == Result::DONE)
+        {
+            static_cast<void>(write_next(true));
+            continue;
+        }
+        Slot &slot = this->slots[static_cast<size_t>(write_count % this->slots.size())];
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->inflated.wait(guard, [&slot]() { return slot.state != SlotState::QUEUED; });
+        slot.state = SlotState::EMPTY;
+        ++write_count;
+    }
+    if (result == Result::DONE && this->member_count == 0U && !sequential)
+    {
+        return this->fail(Result::FORMAT_INVALID, "compressed update is empty");
+    }
+    return result;
+}
+
+cli::ParallelInflate::Result cli::ParallelInflate::run_sequential(Input &input, SpoolFile &out)
+{
+    std::vector<uint8_t> in_buffer(STREAM_BLOCK);
+    std::vector<uint8_t> out_buffer(STREAM_BLOCK);
+    z_stream stream{};
+    if (::inflateInit2(&stream, GZIP_WINDOW) != Z_OK)
+    {
+        return this->fail(Result::FORMAT_INVALID, "zlib initialisation failed");
+    }
+
+    Result result = Result::DONE;
+    bool in_member = false;
+    for (;;)
+    {
+        if (stream.avail_in == 0U)
+        {
+            const ssize_t n = input.read(in_buffer.data(), in_buffer.size());
+            if (n < 0)
+            {
+                result = this->fail(Result::READ_FAILED, "reading compressed update");
+                break;
+            }
+            if (n == 0)
+            {
+                if (in_member)
+                {
+                    result = this->fail(Result::FORMAT_INVALID, "compressed update truncated");
+                }
+                break;
+            }
+            this->compressed_bytes += static_cast<uint64_t>(n);
+            stream.next_in = in_buffer.data();
+            stream.avail_in = static_cast<uInt>(n);
+        }
+
+        in_member = true;
+        stream.next_out = out_buffer.data();
+        stream.avail_out = static_cast<uInt>(out_buffer.size());
+        const int status = ::inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+        {
+            result = this->fail(Result::FORMAT_INVALID, string("corrupt compressed data: ") +
+                                ((stream.msg != nullptr) ? stream.msg : "unknown"));
+            break;
+        }
+        const size_t produced = out_buffer.size() - stream.avail_out;
+        if (produced > 0U && !out.write(out_buffer.data(), produced))
+        {
+            result = this->fail(Result::WRITE_FAILED, "writing " + out.path());
+            break;
+        }
+        /* Concatenated members form one gzip file. */
+        if (status == Z_STREAM_END)
+        {
+            static_cast<void>(::inflateReset(&stream));
+            in_member = false;
+        }
+    }
+    static_cast<void>(::inflateEnd(&stream));
+    return result;
+}
+
+cli::ParallelInflate::Result cli::ParallelInflate::fail(Result result, const string &reason)
+{
+    this->message = reason;
+    if ((result == Result::READ_FAILED || result == Result::WRITE_FAILED) && errno != 0)
+    {
+        this->message += string(": ") + std::strerror(errno);
+    }
+    return result;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cli
+{
+    class SpoolFile;
+
+    /**
+     * Decompresses a gzip-compressed update into a spool file. Files made
+     * of independent gzip members that record their compressed size in a
+     * "BC" extra field (BGZF, written by `bgzip -@N`) are inflated by a
+     * worker pool; the calling thread reads members and writes the results
+     * in order. Members in flight and their inflated data take at most
+     * `budget` bytes, which bounds memory use independent of the update size. Any other gzip
+     * file is inflated sequentially on the calling thread.
+     */
+    class ParallelInflate
+    {
+        public:
+            enum class Result
+            {
+                DONE,
+                FORMAT_INVALID,     ///< Not gzip, corrupt data or CRC mismatch
+                READ_FAILED,        ///< Read error on the source (errno in error())
+                WRITE_FAILED        ///< Write error on the spool file (errno in error())
+            };
+
+            /// Upper bound of a BGZF member, compressed or inflated.
+            static constexpr size_t MEMBER_MAX = 64U * 1024U;
+
+            /// Bytes is_gzip() needs to recognize a BGZF header.
+            static constexpr size_t HEAD = 18U;
+
+            /**
+             * The gzip magic alone is not trusted, a raw image may start with
+             * it: the name must end in ".gz", or head must be a BGZF header.
+             * @param head First bytes of the update, HEAD bytes or all of a shorter one.
+             * @param length Bytes in head.
+             * @param name File name, or anything without ".gz" for a stream.
+             * @return true if the update is to be decompressed.
+             */
+            static bool is_gzip(const void *head, size_t length, const std::string &name);
+
+            /**
+             * @param workers Inflate threads, 1 or more.
+             * @param budget Bytes of member buffers, compressed and inflated;
+             *        at least one member per worker is allowed.
+             */
+            ParallelInflate(unsigned workers, uint64_t budget);
+            ~ParallelInflate();
+
+            ParallelInflate(const ParallelInflate &) = delete;
+            ParallelInflate &operator=(const ParallelInflate &) = delete;
+
+            /**
+             * Inflate source into out until end of input.
+             * @param source Readable descriptor (file, stdin or FIFO).
+             * @param prefix Bytes already read from source (e.g. for format detection).
+             * @param out Spool file; finish() is left to the caller.
+             * @return Result, details in error().
+             */
+            Result run(int source, const std::string &prefix, SpoolFile &out);
+
+            const std::string &error() const { return this->message; }
+
+            unsigned workers() const { return static_cast<unsigned>(this->pool.size()); }
+            uint64_t members() const { return this->member_count; }      ///< Members inflated in parallel (0: sequential)
+            uint64_t compressed() const { return this->compressed_bytes; }
+
+        private:
+            enum class SlotState : uint8_t { EMPTY, QUEUED, READY, FAILED };
+
+            /* One member in flight; buffers are reused for later members. */
+            struct Slot
+            {
+                SlotState state{SlotState::EMPTY};
+                std::vector<uint8_t> input;
+                std::vector<uint8_t> output;
+            };
+
+            class Input;
+
+            std::vector<std::thread> pool;
+            std::vector<Slot> slots;
+            std::deque<size_t> queue;       ///< Slots waiting for a worker
+            std::mutex lock;
+            std::condition_variable queued;
+            std::condition_variable inflated;
+            bool stopping{false};
+
+            std::string message;
+            uint64_t member_count{0};
+            uint64_t compressed_bytes{0};
+
+            void work();
+            static bool inflate_member(Slot &slot);
+            Result run_parallel(Input &input, SpoolFile &out, bool &sequential);
+            Result run_sequential(Input &input, SpoolFile &out);
+            Result fail(Result result, const std::string &reason);
+    };
+}
@@ -0,0 +1,94 @@
+#include "Prefetch.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+cli::Prefetch::Prefetch(const std::string &path, uint64_t window)
+{
+    this->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->fd < 0)
+    {
+        return;
+    }
+    struct stat st{};
+    if (::fstat(this->fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        ::close(this->fd);
+        this->fd = -1;
+        return;
+    }
+    this->size = static_cast<uint64_t>(st.st_size);
+    this->limit = std::min(this->size, window);
+
+    /* Doubles the kernel readahead window of sequential reads on this file. */
+    static_cast<void>(::posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL));
+    if (this->limit > 0U)
+    {
+        this->worker = std::thread(&Prefetch::run, this);
+    }
+}
+
+cli::Prefetch::~Prefetch()
+{
+    this->stopping.store(true, std::memory_order_relaxed);
+    if (this->worker.joinable())
+    {
+        this->worker.join();
+    }
+    if (this->fd >= 0)
+    {
+        ::close(this->fd);
+    }
+}
+
+/* readahead() returns once the reads are queued or, on most block devices,
+ * completed; one chunk at a time keeps the thread stoppable.
+ */
+void cli::Prefetch::run()
+{
+    uint64_t offset = 0U;
+    while (offset < this->limit && !this->stopping.load(std::memory_order_relaxed))
+    {
+        const uint64_t length = std::min(CHUNK, this->limit - offset);
+        if (::readahead(this->fd, static_cast<off64_t>(offset), static_cast<size_t>(length)) != 0)
+        {
+            return;
+        }
+        offset += length;
+        this->done.store(offset, std::memory_order_relaxed);
+    }
+}
+
+bool cli::Prefetch::cached(uint64_t &resident, uint64_t &total) const
+{
+    resident = 0U;
+    total = this->size;
+    if (this->fd < 0 || this->size == 0U)
+    {
+        return false;
+    }
+
+    void *map = ::mmap(nullptr, static_cast<size_t>(this->size), PROT_READ, MAP_SHARED, this->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    const auto page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> pages(static_cast<size_t>((this->size + page - 1U) / page));
+    const bool ok = ::mincore(map, static_cast<size_t>(this->size), pages.data()) == 0;
+    static_cast<void>(::munmap(map, static_cast<size_t>(this->size)));
+    if (!ok)
+    {
+        return false;
+    }
+
+    const auto count = static_cast<uint64_t>(std::count_if(pages.begin(), pages.end(),
+        [](unsigned char state) { return (state & 1U) != 0U; }));
+    resident = std::min(count * page, this->size);
+    return true;
+}
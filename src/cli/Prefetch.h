@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace cli
+{
+    /**
+     * Reads the start of an update file into the page cache on a background
+     * thread, so slow media (USB sticks) are read while the logger, the
+     * serial console and fs::FSUpdate are initialized. At most the configured
+     * window is read ahead; the library's own reads find those pages cached.
+     */
+    class Prefetch
+    {
+        public:
+            /// Bytes per readahead() call; the stop flag is checked in between.
+            static constexpr uint64_t CHUNK = 4U * 1024U * 1024U;
+
+            /**
+             * Open path and start reading ahead. Failures are silent: the
+             * install then simply reads the file itself.
+             * @param path Update file.
+             * @param window Maximum bytes to read ahead.
+             */
+            Prefetch(const std::string &path, uint64_t window);
+            ~Prefetch();
+
+            Prefetch(const Prefetch &) = delete;
+            Prefetch &operator=(const Prefetch &) = delete;
+
+            /**
+             * Count the pages of the file that are in the page cache now.
+             * @param resident Receives the cached bytes.
+             * @param total Receives the file size.
+             * @return false if the file could not be inspected.
+             */
+            bool cached(uint64_t &resident, uint64_t &total) const;
+
+            /**
+             * @return Bytes handed to readahead() so far.
+             */
+            uint64_t issued() const { return this->done.load(std::memory_order_relaxed); }
+
+        private:
+            int fd{-1};
+            uint64_t size{0};
+            uint64_t limit{0};
+            std::atomic<uint64_t> done{0};
+            std::atomic<bool> stopping{false};
+            std::thread worker;
+
+            void run();
+    };
+}
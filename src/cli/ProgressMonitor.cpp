@@ -0,0 +1,251 @@
+#include "ProgressMonitor.h"
+#include "posix_helpers.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr char FD_DIR[] = "/proc/self/fd";
+    constexpr char FDINFO_DIR[] = "/proc/self/fdinfo";
+
+    /* The temporary application image does not exist yet when the phase is
+     * added; resolve its directory so the path matches readlink() output.
+     */
+    string canonical(const string &path)
+    {
+        const std::unique_ptr<char, decltype(&std::free)> full(::realpath(path.c_str(), nullptr), &std::free);
+        if (full)
+        {
+            return full.get();
+        }
+        const string::size_type slash = path.find_last_of('/');
+        if (slash == string::npos || slash == 0)
+        {
+            return path;
+        }
+        const std::unique_ptr<char, decltype(&std::free)> dir(::realpath(path.substr(0, slash).c_str(), nullptr), &std::free);
+        return dir ? posix_helpers::path_join(dir.get(), path.substr(slash + 1)) : path;
+    }
+
+    /* "pos:\t<decimal>" and "flags:\t<octal>" of /proc/self/fdinfo/<fd>. */
+    bool read_fdinfo(const char *fd, uint64_t &position, int &flags)
+    {
+        /* procfs reports size 0, so read_file() cannot be used. */
+        const int info_fd = ::open(posix_helpers::path_join(FDINFO_DIR, fd).c_str(), O_RDONLY | O_CLOEXEC);
+        if (info_fd < 0)
+        {
+            return false;
+        }
+        string info;
+        const bool read_ok = posix_helpers::read_fd(info_fd, info);
+        ::close(info_fd);
+        if (!read_ok)
+        {
+            return false;
+        }
+        const string::size_type pos = info.find("pos:");
+        const string::size_type flg = info.find("flags:");
+        if (pos == string::npos || flg == string::npos)
+        {
+            return false;
+        }
+        position = std::strtoull(info.c_str() + pos + 4, nullptr, 10);
+        flags = static_cast<int>(std::strtol(info.c_str() + flg + 6, nullptr, 8));
+        return true;
+    }
+}
+
+cli::ProgressMonitor::ProgressMonitor(std::chrono::milliseconds interval, Sink sink)
+    : interval(interval), sink(std::move(sink))
+{
+}
+
+cli::ProgressMonitor::~ProgressMonitor()
+{
+    if (this->worker.joinable())
+    {
+        {
+            const std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        this->worker.join();
+    }
+}
+
+void cli::ProgressMonitor::add_phase(const char *phase, const string &path, Access access)
+{
+    const std::lock_guard<std::mutex> guard(this->lock);
+    this->phases.push_back(Phase{phase, canonical(path), access});
+}
+
+void cli::ProgressMonitor::start()
+{
+    if (this->worker.joinable())
+    {
+        return;
+    }
+    this->stopping = false;
+    this->current = 0U;
+    this->started = Clock::now();
+    this->worker = std::thread(&ProgressMonitor::run, this);
+}
+
+void cli::ProgressMonitor::finish(const char *result)
+{
+    if (!this->worker.joinable())
+    {
+        return;
+    }
+    {
+        const std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    this->worker.join();
+    this->sink(this->format(result, Sample{}, 0U));
+
+    const std::lock_guard<std::mutex> guard(this->lock);
+    this->phases.clear();
+}
+
+void cli::ProgressMonitor::run()
+{
+    Sample last;
+    Clock::time_point last_time = Clock::now();
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            if (this->wake.wait_for(guard, this->interval, [this]() { return this->stopping; }))
+            {
+                return;
+            }
+        }
+
+        const Sample now = this->sample();
+        const Clock::time_point now_time = Clock::now();
+        uint64_t rate = 0U;
+        if (now.phase != SIZE_MAX)
+        {
+            this->current = now.phase;
+            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now_time - last_time).count();
+            if (now.phase == last.phase && now.position >= last.position && ms > 0)
+            {
+                rate = ((now.position - last.position) * 1000U) / static_cast<uint64_t>(ms);
+            }
+        }
+
+        const char *name = "install";
+        if (now.phase != SIZE_MAX)
+        {
+            const std::lock_guard<std::mutex> guard(this->lock);
+            name = this->phases[now.phase].name;
+        }
+        this->sink(this->format(name, now, rate));
+        last = now;
+        last_time = now_time;
+    }
+}
+
+cli::ProgressMonitor::Sample cli::ProgressMonitor::sample()
+{
+    std::vector<Phase> known;
+    {
+        const std::lock_guard<std::mutex> guard(this->lock);
+        known = this->phases;
+    }
+
+    Sample found;
+    DIR *dir = ::opendir(FD_DIR);
+    if (dir == nullptr)
+    {
+        return found;
+    }
+
+    char target[PATH_MAX];
+    for (const struct dirent *entry = ::readdir(dir); entry != nullptr; entry = ::readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        const string link = posix_helpers::path_join(FD_DIR, entry->d_name);
+        const ssize_t length = ::readlink(link.c_str(), target, sizeof(target) - 1U);
+        if (length <= 0)
+        {
+            continue;
+        }
+        target[length] = '\0';
+
+        /* Highest phase wins: the library may keep the update file open
+         * while it already writes the application image. Within a phase the
+         * furthest descriptor wins, so another reader of the same file
+         * (e.g. the prefetch) does not hide the library's position.
+         */
+        for (size_t i = known.size(); i > this->current; --i)
+        {
+            const size_t index = i - 1U;
+            if ((found.phase != SIZE_MAX && index < found.phase) || known[index].path != target)
+            {
+                continue;
+            }
+            uint64_t position = 0U;
+            int flags = 0;
+            if (!read_fdinfo(entry->d_name, position, flags))
+            {
+                continue;
+            }
+            const bool reader = (flags & O_ACCMODE) == O_RDONLY;
+            if (reader != (known[index].access == Access::READ) ||
+                (index == found.phase && position <= found.position))
+            {
+                continue;
+            }
+
+            struct stat st{};
+            found.phase = index;
+            found.position = position;
+            found.total = (reader && ::stat(link.c_str(), &st) == 0) ? static_cast<uint64_t>(st.st_size) : 0U;
+            break;
+        }
+    }
+    ::closedir(dir);
+    return found;
+}
+
+string cli::ProgressMonitor::format(const char *phase, const Sample &now, uint64_t rate) const
+{
+    const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - this->started).count();
+    string line = string("install progress: phase=") + phase;
+
+    if (now.phase != SIZE_MAX)
+    {
+        line += " bytes=" + std::to_string(now.position);
+        if (now.total > 0U)
+        {
+            const uint64_t done = (now.position < now.total) ? now.position : now.total;
+            line += " total=" + std::to_string(now.total) + " percent=" + std::to_string((done * 100U) / now.total);
+            if (rate > 0U)
+            {
+                line += " eta_s=" + std::to_string((now.total - done) / rate);
+            }
+        }
+        line += " rate_kib=" + std::to_string(rate / 1024U);
+    }
+    line += " elapsed_s=" + std::to_string(static_cast<uint64_t>(elapsed)) + "\n";
+    return line;
+}
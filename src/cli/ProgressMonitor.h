@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cli
+{
+    /**
+     * Reports the progress of an install that runs inside one blocking
+     * fs-updater-lib call. The library offers no callback, so a background
+     * thread samples the files the CLI knows about (spool file, update file,
+     * temporary application image): an open descriptor on one of them names
+     * the phase, its file offset in /proc/self/fdinfo the bytes processed.
+     * Work outside this process, e.g. RAUC writing the firmware slot, is
+     * reported as phase "install" with elapsed time only.
+     *
+     * One line is emitted per interval, so reporting costs a directory scan
+     * per interval and nothing per byte.
+     */
+    class ProgressMonitor
+    {
+        public:
+            using Sink = std::function<void(const std::string &line)>;
+
+            /// Access mode of the descriptor that marks a phase.
+            enum class Access : uint8_t
+            {
+                READ,
+                WRITE
+            };
+
+            /**
+             * @param interval Minimum time between two lines.
+             * @param sink Receives each line including the trailing newline;
+             *             called from the monitor thread.
+             */
+            ProgressMonitor(std::chrono::milliseconds interval, Sink sink);
+            ~ProgressMonitor();
+
+            ProgressMonitor(const ProgressMonitor &) = delete;
+            ProgressMonitor &operator=(const ProgressMonitor &) = delete;
+
+            /**
+             * Add a phase. Phases only move forward in the order they were
+             * added, so a descriptor left open by an earlier phase is ignored.
+             * @param phase Name printed in the progress line.
+             * @param path File whose open descriptor marks the phase.
+             * @param access Descriptor access mode to match.
+             */
+            void add_phase(const char *phase, const std::string &path, Access access);
+
+            /**
+             * Start the monitor thread; does nothing if it is running.
+             */
+            void start();
+
+            /**
+             * Stop the monitor thread, emit a final line and drop the phases.
+             * @param result Phase name of the final line, e.g. "done" or "failed".
+             */
+            void finish(const char *result);
+
+        private:
+            struct Phase
+            {
+                const char *name;
+                std::string path;
+                Access access;
+            };
+
+            struct Sample
+            {
+                size_t phase{SIZE_MAX};        ///< SIZE_MAX: no matching descriptor
+                uint64_t position{0};
+                uint64_t total{0};             ///< 0: size unknown (written file)
+            };
+
+            std::chrono::milliseconds interval;
+            Sink sink;
+            std::vector<Phase> phases;
+            std::mutex lock;
+            std::condition_variable wake;
+            std::thread worker;
+            bool stopping{false};
+            std::chrono::steady_clock::time_point started;
+            size_t current{0};                 ///< Lowest phase still accepted
+
+            void run();
+            Sample sample();
+            std::string format(const char *phase, const Sample &now, uint64_t rate) const;
+    };
+}
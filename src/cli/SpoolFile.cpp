@@ -0,0 +1,113 @@
+#include "SpoolFile.h"
+#include "posix_helpers.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace
+{
+    constexpr char SPOOL_PREFIX[] = "fs-updater-spool-XXXXXX";
+    constexpr size_t COPY_BLOCK = 256U * 1024U;
+}
+
+cli::SpoolFile::SpoolFile(const string &dir, const string &suffix)
+{
+    std::vector<char> name;
+    const string pattern = posix_helpers::path_join(dir, SPOOL_PREFIX) + suffix;
+    name.assign(pattern.begin(), pattern.end());
+    name.push_back('\0');
+
+    this->fd = ::mkostemps(name.data(), static_cast<int>(suffix.size()), O_CLOEXEC);
+    if (this->fd >= 0)
+    {
+        this->file_path = name.data();
+        this->writer = std::make_unique<BlockWriter>(this->fd);
+    }
+}
+
+cli::SpoolFile::~SpoolFile()
+{
+    if (this->fd >= 0)
+    {
+        ::close(this->fd);
+        static_cast<void>(posix_helpers::remove_file(this->file_path.c_str()));
+    }
+}
+
+bool cli::SpoolFile::write(const void *data, size_t length)
+{
+    if (!this->writer->write(data, length))
+    {
+        return false;
+    }
+
+    if (this->writer->committed() - this->flushed >= 2U * WINDOW)
+    {
+        this->write_back(false);
+    }
+    return true;
+}
+
+bool cli::SpoolFile::copy_from(int source)
+{
+    const std::unique_ptr<char[]> buffer = std::make_unique<char[]>(COPY_BLOCK);
+    for (;;)
+    {
+        const ssize_t n = ::read(source, buffer.get(), COPY_BLOCK);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0) { return false; }
+        if (n == 0) { return true; }
+        if (!this->write(buffer.get(), static_cast<size_t>(n))) { return false; }
+    }
+}
+
+bool cli::SpoolFile::finish()
+{
+    if (!this->writer->finish())
+    {
+        return false;
+    }
+    this->write_back(true);
+    return ::fdatasync(this->fd) == 0;
+}
+
+bool cli::SpoolFile::on_tmpfs() const
+{
+    struct statfs fs{};
+    return (::fstatfs(this->fd, &fs) == 0) && (fs.f_type == TMPFS_MAGIC);
+}
+
+/* The oldest window is written back synchronously and dropped while the
+ * newest one is only queued, so the writer never waits for its own last
+ * write and at most two windows stay in the page cache.
+ */
+void cli::SpoolFile::write_back(bool all)
+{
+    const uint64_t committed = this->writer->committed();
+    const uint64_t end = all ? committed : committed - WINDOW;
+    if (end <= this->flushed)
+    {
+        return;
+    }
+    const auto offset = static_cast<off64_t>(this->flushed);
+    const auto length = static_cast<off64_t>(end - this->flushed);
+
+    static_cast<void>(::sync_file_range(this->fd, offset, length,
+        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER));
+    static_cast<void>(::posix_fadvise(this->fd, offset, length, POSIX_FADV_DONTNEED));
+    if (!all)
+    {
+        static_cast<void>(::sync_file_range(this->fd, static_cast<off64_t>(end),
+            static_cast<off64_t>(committed - end), SYNC_FILE_RANGE_WRITE));
+    }
+    this->flushed = end;
+}
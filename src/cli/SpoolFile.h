@@ -0,0 +1,86 @@
+#pragma once
+
+#include "BlockWriter.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace cli
+{
+    /**
+     * Temporary file that receives an update streamed from a pipe, so that
+     * fs-updater-lib can open it by path. It is created in FUS_CLI_SPOOL_DIR,
+     * which must be on persistent storage rather than tmpfs. Written data is
+     * pushed to storage and dropped from the page cache every WINDOW bytes, so
+     * memory use does not grow with the size of the update. Zero blocks are
+     * left as holes (see BlockWriter). The file is removed by the destructor.
+     */
+    class SpoolFile
+    {
+        public:
+            /// Written bytes between two writeback steps.
+            static constexpr uint64_t WINDOW = 8U * 1024U * 1024U;
+
+            /**
+             * @param dir Directory to create the file in.
+             * @param suffix File name suffix, e.g. ".fs".
+             */
+            SpoolFile(const std::string &dir, const std::string &suffix);
+            ~SpoolFile();
+
+            SpoolFile(const SpoolFile &) = delete;
+            SpoolFile &operator=(const SpoolFile &) = delete;
+
+            /**
+             * @return false if the file could not be created (errno set).
+             */
+            bool valid() const { return this->fd >= 0; }
+
+            /**
+             * Append data; retries short writes.
+             * @return false on error (errno set).
+             */
+            [[nodiscard]] bool write(const void *data, size_t length);
+
+            /**
+             * Copy from a descriptor until end of file.
+             * @return false on a read or write error (errno set).
+             */
+            [[nodiscard]] bool copy_from(int source);
+
+            /**
+             * Write back the remaining data; call before the file is handed on.
+             * @return false on error (errno set).
+             */
+            [[nodiscard]] bool finish();
+
+            /**
+             * @return true if the spool directory is a tmpfs, which would keep
+             *         the whole update in RAM.
+             */
+            bool on_tmpfs() const;
+
+            const std::string &path() const { return this->file_path; }
+            uint64_t size() const { return this->writer ? this->writer->size() : 0U; }
+
+            /**
+             * @return Write statistics; valid() must be true.
+             */
+            const BlockWriter &stats() const { return *this->writer; }
+
+            /**
+             * @param throttle Write rate limiter, nullptr for none; not owned. valid() must be true.
+             */
+            void set_throttle(Throttle *throttle) { this->writer->set_throttle(throttle); }
+
+        private:
+            std::string file_path;
+            int fd{-1};
+            std::unique_ptr<BlockWriter> writer;
+            uint64_t flushed{0};    ///< Bytes already written back and dropped
+
+            void write_back(bool all);
+    };
+}
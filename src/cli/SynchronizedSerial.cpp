@@ -1,14 +1,147 @@
 #include "SynchronizedSerial.h"
+#include "posix_helpers.h"
+#include "config.h"
 
+#include <cctype>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+namespace
+{
+    constexpr char CONSOLE_CACHE_FILE[] = "console";
+
+    /* Virtual terminals (tty0, tty1, ...) are never the update console. */
+    bool is_virtual_terminal(const std::string &name)
+    {
+        if (name.size() <= 3 || name.compare(0, 3, "tty") != 0)
+        {
+            return false;
+        }
+        for (std::string::size_type i = 3; i < name.size(); ++i)
+        {
+            if (!std::isdigit(static_cast<unsigned char>(name[i])))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Last entry of /sys/class/tty/console/active is the device behind /dev/console. */
+    std::string console_from_sysfs()
+    {
+        std::string active;
+        if (!posix_helpers::read_file("/sys/class/tty/console/active", active))
+        {
+            return std::string();
+        }
+        std::string result;
+        std::string::size_type pos = 0;
+        while (pos < active.size())
+        {
+            pos = active.find_first_not_of(" \t", pos);
+            if (pos == std::string::npos)
+            {
+                break;
+            }
+            const std::string::size_type end = active.find_first_of(" \t", pos);
+            const std::string name = active.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+            if (!is_virtual_terminal(name))
+            {
+                result = name;
+            }
+            pos = end;
+        }
+        return result;
+    }
+
+    /* Last console=<name>[,<options>] on the kernel command line wins. */
+    std::string console_from_cmdline()
+    {
+        std::string cmdline;
+        if (!posix_helpers::read_file("/proc/cmdline", cmdline))
+        {
+            return std::string();
+        }
+        std::string result;
+        std::string::size_type pos = 0;
+        while ((pos = cmdline.find("console=", pos)) != std::string::npos)
+        {
+            if (pos != 0 && cmdline[pos - 1] != ' ')
+            {
+                pos += 8;
+                continue;
+            }
+            pos += 8;
+            const std::string::size_type end = cmdline.find_first_of(" ,", pos);
+            const std::string name = cmdline.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+            if (!name.empty() && !is_virtual_terminal(name))
+            {
+                result = name;
+            }
+        }
+        return result;
+    }
+
+    std::string console_from_cache()
+    {
+        std::string name;
+        if (!posix_helpers::read_file(posix_helpers::path_join(FUS_CLI_RUN_DIR, CONSOLE_CACHE_FILE).c_str(), name))
+        {
+            return std::string();
+        }
+        return name;
+    }
+
+    void store_console_cache(const std::string &name)
+    {
+        if (::mkdir(FUS_CLI_RUN_DIR, 0700) != 0 && errno != EEXIST)
+        {
+            return;
+        }
+        const std::string path = posix_helpers::path_join(FUS_CLI_RUN_DIR, CONSOLE_CACHE_FILE);
+        const std::string tmp_path = path + ".tmp";
+        const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return;
+        }
+        const bool written = ::write(fd, name.data(), name.size()) == static_cast<ssize_t>(name.size());
+        ::close(fd);
+        if (!written || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            static_cast<void>(posix_helpers::remove_file(tmp_path.c_str()));
+        }
+    }
+
+    std::string console_from_uboot()
+    {
+        UBoot::UBoot uboot_handler("/etc/fw_env.config");
+        return util::split(util::split(uboot_handler.getVariable("console"),'=').back(), ',').at(0);
+    }
+}
+
 SynchronizedSerial::SynchronizedSerial()
 {
-    UBoot::UBoot uboot_handler("/etc/fw_env.config");
-    const std::string console = util::split(util::split(uboot_handler.getVariable("console"),'=').back(), ',').at(0);
-    const std::string dev_path = std::string("/dev/") + console;
-    this->serial_fd = ::open(dev_path.c_str(), O_WRONLY | O_NOCTTY | O_CLOEXEC);
+    const auto start = std::chrono::steady_clock::now();
+
+    /* Cheapest source first; the U-Boot environment is only parsed if
+     * none of the others names a device that can be opened.
+     */
+    if (!this->open_console(console_from_sysfs(), "sysfs") &&
+        !this->open_console(console_from_cmdline(), "cmdline") &&
+        !this->open_console(console_from_cache(), "cache"))
+    {
+        const std::string console = console_from_uboot();
+        if (this->open_console(console, "uboot"))
+        {
+            store_console_cache(console);
+        }
+    }
+
+    this->setup_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
 }
 
 SynchronizedSerial::~SynchronizedSerial()
@@ -19,6 +152,38 @@ SynchronizedSerial::~SynchronizedSerial()
     }
 }
 
+bool SynchronizedSerial::open_console(const std::string &console, const char *source)
+{
+    if (console.empty() || console.find('/') != std::string::npos)
+    {
+        return false;
+    }
+    const std::string dev_path = std::string("/dev/") + console;
+    this->serial_fd = ::open(dev_path.c_str(), O_WRONLY | O_NOCTTY | O_CLOEXEC);
+    if (this->serial_fd < 0)
+    {
+        return false;
+    }
+    this->device = dev_path;
+    this->device_source = source;
+    return true;
+}
+
+const std::string &SynchronizedSerial::getDevice() const
+{
+    return this->device;
+}
+
+const char *SynchronizedSerial::getSource() const
+{
+    return this->device_source;
+}
+
+std::chrono::microseconds SynchronizedSerial::getSetupTime() const
+{
+    return this->setup_time;
+}
+
 void SynchronizedSerial::write(const std::string &in)
 {
     if (this->serial_fd < 0) { return; }
@@ -34,3 +199,28 @@ void SynchronizedSerial::write(const std::string &in)
         remaining -= static_cast<std::string::size_type>(written);
     }
 }
+
+void SynchronizedSerial::writev(struct iovec *iov, int count)
+{
+    if (this->serial_fd < 0) { return; }
+
+    std::lock_guard<std::mutex> lock(this->lock_query);
+    while (count > 0)
+    {
+        ssize_t written = ::writev(this->serial_fd, iov, count);
+        if (written <= 0) { break; }
+
+        /* Skip the buffers that were written completely, then trim the partial one. */
+        while (count > 0 && static_cast<size_t>(written) >= iov->iov_len)
+        {
+            written -= static_cast<ssize_t>(iov->iov_len);
+            ++iov;
+            --count;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+            iov->iov_len -= static_cast<size_t>(written);
+        }
+    }
+}
@@ -2,6 +2,9 @@
 
 #include <string>
 #include <mutex>
+#include <chrono>
+
+#include <sys/uio.h>
 
 #include <fs_update_framework/uboot_interface/UBoot.h>
 #include <fs_update_framework/handle_update/utils.h>
@@ -11,10 +14,23 @@ class SynchronizedSerial
     private:
         int serial_fd{-1};
         std::mutex lock_query;
+        std::string device;
+        const char *device_source{"none"};
+        std::chrono::microseconds setup_time{0};
+
+        /**
+         * Open /dev/<console> and remember where the name came from.
+         * @param console Device name without /dev/, may be empty.
+         * @param source Name of the lookup that produced the device name.
+         * @return true if the device was opened.
+         */
+        bool open_console(const std::string &console, const char *source);
 
     public:
         /**
-         * Read from UBoot the standard serial output interface and redirect all output to that.
+         * Resolve the serial console and redirect all output to that.
+         * Precedence: /sys/class/tty/console/active, console= on /proc/cmdline,
+         * the cached result of an earlier U-Boot lookup, the U-Boot "console" variable.
          */
         SynchronizedSerial();
         ~SynchronizedSerial();
@@ -28,4 +44,27 @@ class SynchronizedSerial
          * @param in String for serial output.
          */
         void write(const std::string &in);
+
+        /**
+         * Write several buffers with one system call where possible.
+         * Lock the resource serial for the whole batch.
+         * @param iov Buffers to write; modified when the port accepts a partial write.
+         * @param count Number of buffers.
+         */
+        void writev(struct iovec *iov, int count);
+
+        /**
+         * @return Opened device path, empty if no console could be opened.
+         */
+        const std::string &getDevice() const;
+
+        /**
+         * @return Lookup that resolved the device: sysfs, cmdline, cache, uboot or none.
+         */
+        const char *getSource() const;
+
+        /**
+         * @return Time spent resolving and opening the console.
+         */
+        std::chrono::microseconds getSetupTime() const;
 };
@@ -0,0 +1,113 @@
+#include "Throttle.h"
+#include "posix_helpers.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace
+{
+    constexpr std::chrono::seconds CHECK_INTERVAL{1};
+
+    /* "some avg10=<percent> ..." of a /proc/pressure file; false without PSI. */
+    bool stall_share(const char *path, double &share)
+    {
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        string text;
+        const bool ok = posix_helpers::read_fd(fd, text);
+        ::close(fd);
+        const string::size_type at = text.find("some avg10=");
+        if (!ok || at == string::npos)
+        {
+            return false;
+        }
+        share = std::strtod(text.c_str() + at + 11, nullptr);
+        return true;
+    }
+}
+
+cli::Throttle::Throttle(uint64_t cap, bool adaptive)
+    : cap_rate(std::max<uint64_t>(cap, 1U)), rate(cap_rate), lowest_rate(cap_rate), adaptive(adaptive)
+{
+}
+
+void cli::Throttle::consume(size_t length)
+{
+    const Clock::time_point now = Clock::now();
+    if (!this->started)
+    {
+        this->started = true;
+        this->start = now;
+        this->refilled = now;
+        this->next_check = now + CHECK_INTERVAL;
+    }
+    if (this->adaptive && now >= this->next_check)
+    {
+        this->adapt(now);
+    }
+
+    const double burst = static_cast<double>(this->rate) / 8.0;
+    const double elapsed = std::chrono::duration<double>(now - this->refilled).count();
+    this->tokens = std::min(burst, this->tokens + elapsed * static_cast<double>(this->rate));
+    this->refilled = now;
+    this->total += length;
+
+    /* The write may run into debt; it is paid by sleeping before returning. */
+    this->tokens -= static_cast<double>(length);
+    if (this->tokens < 0.0)
+    {
+        const auto pause = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(-this->tokens / static_cast<double>(this->rate)));
+        std::this_thread::sleep_for(pause);
+        this->waited += pause;
+    }
+}
+
+void cli::Throttle::adapt(Clock::time_point now)
+{
+    this->next_check = now + CHECK_INTERVAL;
+    double io = 0.0;
+    double cpu = 0.0;
+    const bool have_io = stall_share("/proc/pressure/io", io);
+    const bool have_cpu = stall_share("/proc/pressure/cpu", cpu);
+    if (!have_io && !have_cpu)
+    {
+        return;
+    }
+
+    const double pressure = std::max(io, cpu);
+    if (pressure > PSI_HIGH)
+    {
+        this->rate = std::max(this->rate / 2U, std::max<uint64_t>(this->cap_rate / 16U, 1U));
+    }
+    else if (pressure < PSI_LOW)
+    {
+        this->rate = std::min(this->rate + std::max<uint64_t>(this->cap_rate / 8U, 1U), this->cap_rate);
+    }
+    this->lowest_rate = std::min(this->lowest_rate, this->rate);
+}
+
+uint64_t cli::Throttle::waited_ms() const
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(this->waited).count());
+}
+
+uint64_t cli::Throttle::achieved() const
+{
+    if (!this->started)
+    {
+        return 0U;
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - this->start).count();
+    return (seconds > 0.0) ? static_cast<uint64_t>(static_cast<double>(this->total) / seconds) : 0U;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace cli
+{
+    /**
+     * Token bucket that paces writes to a byte rate. consume() sleeps once
+     * the writer is ahead of the rate; short bursts (an eighth of a second
+     * worth of data) pass without waiting. With adaptive pacing the rate
+     * is halved while /proc/pressure/io or /proc/pressure/cpu reports more
+     * than PSI_HIGH % stall time over the last 10 s, down to 1/16 of the
+     * cap, and raised again in steps of 1/8 once it falls below PSI_LOW %.
+     */
+    class Throttle
+    {
+        public:
+            /// Stall share (avg10, percent) above which the rate is lowered.
+            static constexpr double PSI_HIGH = 10.0;
+            /// Stall share below which the rate recovers towards the cap.
+            static constexpr double PSI_LOW = 2.0;
+
+            /**
+             * @param cap Bytes per second.
+             * @param adaptive Follow pressure stall information.
+             */
+            Throttle(uint64_t cap, bool adaptive);
+
+            /**
+             * Account for a write of length bytes, sleeping as needed.
+             * @param length Bytes about to be written.
+             */
+            void consume(size_t length);
+
+            uint64_t cap() const { return this->cap_rate; }
+            uint64_t lowest() const { return this->lowest_rate; }    ///< Lowest adaptive rate used
+            uint64_t bytes() const { return this->total; }
+            uint64_t waited_ms() const;
+
+            /**
+             * @return Bytes per second from the first write until now, 0 before it.
+             */
+            uint64_t achieved() const;
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            uint64_t cap_rate;
+            uint64_t rate;
+            uint64_t lowest_rate;
+            bool adaptive;
+            double tokens{0.0};
+            uint64_t total{0};
+            bool started{false};
+            Clock::time_point start;
+            Clock::time_point refilled;
+            Clock::time_point next_check;
+            Clock::duration waited{0};
+
+            void adapt(Clock::time_point now);
+    };
+}
@@ -0,0 +1,164 @@
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include <json/json.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+    uint64_t micros(Clock::duration duration)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+}
+
+cli::Tracer::Scope::Scope(Tracer *tracer, const char *name)
+    : tracer(tracer), name(name)
+{
+    if (this->tracer != nullptr)
+    {
+        this->start = Clock::now();
+    }
+}
+
+cli::Tracer::Scope::~Scope()
+{
+    if (this->tracer != nullptr)
+    {
+        this->tracer->record(this->name, this->start, Clock::now());
+    }
+}
+
+cli::Tracer &cli::Tracer::get()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+void cli::Tracer::enable()
+{
+    if (!this->active)
+    {
+        this->epoch = Clock::now();
+        this->active = true;
+    }
+}
+
+void cli::Tracer::disable()
+{
+    this->active = false;
+    this->used.store(0U, std::memory_order_relaxed);
+    this->dropped.store(0U, std::memory_order_relaxed);
+}
+
+void cli::Tracer::record(const char *name, Clock::time_point start, Clock::time_point end)
+{
+    const size_t slot = this->used.fetch_add(1U, std::memory_order_relaxed);
+    if (slot >= CAPACITY)
+    {
+        this->used.store(CAPACITY, std::memory_order_relaxed);
+        this->dropped.fetch_add(1U, std::memory_order_relaxed);
+        return;
+    }
+    this->spans[slot] = Span{name, micros(start - this->epoch), micros(end - start),
+                             static_cast<uint32_t>(::syscall(SYS_gettid))};
+}
+
+bool cli::Tracer::write_chrome_trace(const string &path, string &error) const
+{
+    const size_t count = std::min(this->used.load(std::memory_order_relaxed), CAPACITY);
+    const auto pid = static_cast<Json::UInt>(::getpid());
+
+    Json::Value root(Json::objectValue);
+    Json::Value &events = root["traceEvents"];
+    events = Json::Value(Json::arrayValue);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Span &span = this->spans[i];
+        Json::Value event(Json::objectValue);
+        event["name"] = span.name;
+        event["cat"] = "fs-updater";
+        event["ph"] = "X";
+        event["ts"] = static_cast<Json::UInt64>(span.start_us);
+        event["dur"] = static_cast<Json::UInt64>(span.duration_us);
+        event["pid"] = pid;
+        event["tid"] = static_cast<Json::UInt>(span.tid);
+        events.append(event);
+    }
+    root["displayTimeUnit"] = "ms";
+    root["otherData"]["dropped_spans"] = static_cast<Json::UInt64>(this->dropped.load(std::memory_order_relaxed));
+
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    const std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+    writer->write(root, &out);
+    out << '\n';
+    out.close();
+    if (!out)
+    {
+        error = "write to " + path + " failed";
+        return false;
+    }
+    return true;
+}
+
+string cli::Tracer::summary() const
+{
+    struct Total
+    {
+        const char *name;
+        uint64_t count;
+        uint64_t total_us;
+        uint64_t max_us;
+    };
+
+    /* Few distinct names; a linear search keeps the order of first use. */
+    std::vector<Total> totals;
+    const size_t count = std::min(this->used.load(std::memory_order_relaxed), CAPACITY);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Span &span = this->spans[i];
+        auto it = std::find_if(totals.begin(), totals.end(),
+            [&span](const Total &t) { return string(t.name) == span.name; });
+        if (it == totals.end())
+        {
+            totals.push_back(Total{span.name, 0U, 0U, 0U});
+            it = totals.end() - 1;
+        }
+        ++it->count;
+        it->total_us += span.duration_us;
+        it->max_us = std::max(it->max_us, span.duration_us);
+    }
+
+    char line[128];
+    static_cast<void>(std::snprintf(line, sizeof(line), "%-28s %6s %12s %12s\n", "Span", "Count", "Total ms", "Max ms"));
+    string table = line;
+    for (const Total &t : totals)
+    {
+        static_cast<void>(std::snprintf(line, sizeof(line), "%-28s %6llu %12.3f %12.3f\n", t.name,
+            static_cast<unsigned long long>(t.count), static_cast<double>(t.total_us) / 1000.0,
+            static_cast<double>(t.max_us) / 1000.0));
+        table += line;
+    }
+    const size_t lost = this->dropped.load(std::memory_order_relaxed);
+    if (lost > 0U)
+    {
+        table += std::to_string(lost) + " spans dropped (capacity " + std::to_string(CAPACITY) + ")\n";
+    }
+    return table;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cli
+{
+    /**
+     * Records how long the significant calls of one invocation take.
+     * Spans go into a fixed array, so recording never allocates; spans
+     * beyond CAPACITY are counted as dropped. While tracing is disabled a
+     * span costs one test of a flag that never changes during the run.
+     */
+    class Tracer
+    {
+        public:
+            /// Spans kept per invocation.
+            static constexpr size_t CAPACITY = 256;
+
+            /**
+             * Ends its span when it goes out of scope.
+             */
+            class Scope
+            {
+                public:
+                    Scope(Tracer *tracer, const char *name);
+                    ~Scope();
+
+                    Scope(const Scope &) = delete;
+                    Scope &operator=(const Scope &) = delete;
+
+                private:
+                    Tracer *tracer;
+                    const char *name;
+                    std::chrono::steady_clock::time_point start;
+            };
+
+            /**
+             * @return Process-wide tracer.
+             */
+            static Tracer &get();
+
+            /**
+             * Start recording. Timestamps are relative to this call.
+             */
+            void enable();
+
+            /**
+             * Stop recording and drop the recorded spans, so the next
+             * daemon or batch request starts empty.
+             */
+            void disable();
+
+            bool enabled() const { return this->active; }
+
+            /**
+             * Open a span; a no-op while tracing is disabled.
+             * @param name Span name; must outlive the tracer (string literal).
+             * @return Scope that records the span when destroyed.
+             */
+            Scope span(const char *name) { return Scope(this->active ? this : nullptr, name); }
+
+            /**
+             * Write the spans as Chrome trace-event JSON (chrome://tracing, Perfetto).
+             * @param path Output file.
+             * @param error Receives the reason on failure.
+             * @return false if the file could not be written.
+             */
+            bool write_chrome_trace(const std::string &path, std::string &error) const;
+
+            /**
+             * @return Table with count, total and longest duration per span name.
+             */
+            std::string summary() const;
+
+        private:
+            struct Span
+            {
+                const char *name;
+                uint64_t start_us;
+                uint64_t duration_us;
+                uint32_t tid;
+            };
+
+            std::array<Span, CAPACITY> spans{};
+            std::atomic<size_t> used{0};
+            std::atomic<size_t> dropped{0};
+            std::chrono::steady_clock::time_point epoch;
+            bool active{false};
+
+            Tracer() = default;
+
+            void record(const char *name, std::chrono::steady_clock::time_point start,
+                        std::chrono::steady_clock::time_point end);
+    };
+}
+
+#define FSCLI_TRACE_CONCAT2(a, b) a##b
+#define FSCLI_TRACE_CONCAT(a, b) FSCLI_TRACE_CONCAT2(a, b)
+
+/* Span from this line to the end of the enclosing block. */
+#define FSCLI_TRACE_SPAN(name) \
+    const cli::Tracer::Scope FSCLI_TRACE_CONCAT(fscli_trace_span_, __LINE__) = cli::Tracer::get().span(name)
@@ -0,0 +1,191 @@
+#include "VerifyCache.h"
+#include "posix_helpers.h"
+#include "config.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using std::string;
+
+namespace
+{
+    constexpr char CACHE_FILE[] = "verify.cache";
+    constexpr char CACHE_HEADER[] = "fs-updater-verify-cache 1 " FUS_CLI_PROJECT_VERSION;
+    /* Start and end of the file: catches rewrites that restore mtime and keep the size. */
+    constexpr size_t EDGE_BYTES = 64U * 1024U;
+
+    string cache_path()
+    {
+        return posix_helpers::path_join(FUS_CLI_RUN_DIR, CACHE_FILE);
+    }
+
+    int64_t nanoseconds(const struct timespec &time)
+    {
+        return static_cast<int64_t>(time.tv_sec) * 1000000000LL + static_cast<int64_t>(time.tv_nsec);
+    }
+
+    bool crc_range(int fd, off_t offset, size_t length, uLong &crc)
+    {
+        const std::unique_ptr<char[]> buffer = std::make_unique<char[]>(length);
+        size_t got = 0;
+        while (got < length)
+        {
+            const ssize_t n = ::pread(fd, buffer.get() + got, length - got, offset + static_cast<off_t>(got));
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return false; }
+            got += static_cast<size_t>(n);
+        }
+        crc = ::crc32(crc, reinterpret_cast<const Bytef *>(buffer.get()), static_cast<uInt>(length));
+        return true;
+    }
+
+    string key_line(const cli::VerifyCache::Key &key)
+    {
+        return "key\t" + std::to_string(key.device) + "\t" + std::to_string(key.inode) + "\t" +
+               std::to_string(key.size) + "\t" + std::to_string(key.mtime_ns) + "\t" +
+               std::to_string(key.ctime_ns) + "\t" + std::to_string(key.edge_crc);
+    }
+
+    std::vector<string> split(const string &line, char separator)
+    {
+        std::vector<string> fields;
+        string::size_type start = 0;
+        for (;;)
+        {
+            const string::size_type end = line.find(separator, start);
+            fields.push_back(line.substr(start, end - start));
+            if (end == string::npos)
+            {
+                return fields;
+            }
+            start = end + 1;
+        }
+    }
+
+    uint32_t text_crc(const string &text)
+    {
+        return static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(text.data()),
+                                             static_cast<uInt>(text.size())));
+    }
+}
+
+bool cli::VerifyCache::Key::operator==(const Key &other) const
+{
+    return this->device == other.device && this->inode == other.inode && this->size == other.size &&
+           this->mtime_ns == other.mtime_ns && this->ctime_ns == other.ctime_ns &&
+           this->edge_crc == other.edge_crc;
+}
+
+bool cli::VerifyCache::identify(const string &path, Key &key)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st{};
+    bool ok = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok)
+    {
+        key.device = static_cast<uint64_t>(st.st_dev);
+        key.inode = static_cast<uint64_t>(st.st_ino);
+        key.size = static_cast<uint64_t>(st.st_size);
+        key.mtime_ns = nanoseconds(st.st_mtim);
+        key.ctime_ns = nanoseconds(st.st_ctim);
+
+        const size_t head = (key.size < EDGE_BYTES) ? static_cast<size_t>(key.size) : EDGE_BYTES;
+        uLong crc = ::crc32(0L, Z_NULL, 0U);
+        ok = crc_range(fd, 0, head, crc) &&
+             crc_range(fd, static_cast<off_t>(key.size - head), head, crc);
+        key.edge_crc = static_cast<uint32_t>(crc);
+    }
+    ::close(fd);
+    return ok;
+}
+
+bool cli::VerifyCache::lookup(const Key &key, std::vector<BundleVerifier::Component> &components)
+{
+    string text;
+    if (!posix_helpers::read_file(cache_path().c_str(), text))
+    {
+        return false;
+    }
+
+    /* The last line holds the CRC of everything before it. */
+    const string::size_type last = text.rfind('\n');
+    if (last == string::npos || text.compare(last + 1, 4, "crc\t") != 0 ||
+        std::strtoul(text.c_str() + last + 5, nullptr, 16) != text_crc(text.substr(0, last + 1)))
+    {
+        return false;
+    }
+
+    const std::vector<string> lines = split(text.substr(0, last), '\n');
+    if (lines.size() < 2U || lines[0] != CACHE_HEADER || lines[1] != key_line(key))
+    {
+        return false;
+    }
+
+    std::vector<BundleVerifier::Component> stored;
+    for (size_t i = 2; i < lines.size(); ++i)
+    {
+        const std::vector<string> fields = split(lines[i], '\t');
+        if (fields.size() != 6U || fields[0] != "c")
+        {
+            return false;
+        }
+        BundleVerifier::Component component;
+        component.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+        component.sha256 = fields[2];
+        component.expected_sha256 = fields[2];
+        component.file = fields[3];
+        component.handler = fields[4];
+        component.version = fields[5];
+        stored.push_back(component);
+    }
+    components = std::move(stored);
+    return true;
+}
+
+void cli::VerifyCache::store(const Key &key, const std::vector<BundleVerifier::Component> &components)
+{
+    string text = string(CACHE_HEADER) + "\n" + key_line(key) + "\n";
+    for (const auto &component : components)
+    {
+        text += "c\t" + std::to_string(component.size) + "\t" + component.sha256 + "\t" + component.file +
+                "\t" + component.handler + "\t" + component.version + "\n";
+    }
+    char crc[16];
+    static_cast<void>(std::snprintf(crc, sizeof(crc), "%08x", text_crc(text)));
+    text += string("crc\t") + crc + "\n";
+
+    if (::mkdir(FUS_CLI_RUN_DIR, 0700) != 0 && errno != EEXIST)
+    {
+        return;
+    }
+    const string path = cache_path();
+    const string tmp_path = path + ".tmp";
+    const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return;
+    }
+    const bool written = ::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+    ::close(fd);
+    if (!written || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        static_cast<void>(posix_helpers::remove_file(tmp_path.c_str()));
+    }
+}
+
+void cli::VerifyCache::invalidate()
+{
+    static_cast<void>(posix_helpers::remove_file(cache_path().c_str()));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "BundleVerifier.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cli
+{
+    /**
+     * Remembers the last bundle that passed --check_integrity, so a retry on the
+     * unchanged file skips the full read. The entry lives in FUS_CLI_RUN_DIR
+     * (tmpfs, cleared on reboot) and is only used if every field of the file
+     * identity still matches: device, inode, size, mtime and ctime in
+     * nanoseconds, a CRC of the first and last 64 KiB and the CLI version.
+     * Only successful results are stored; any other result removes the entry.
+     */
+    class VerifyCache
+    {
+        public:
+            /**
+             * Identity of a bundle file at one point in time.
+             */
+            struct Key
+            {
+                uint64_t device{0};
+                uint64_t inode{0};
+                uint64_t size{0};
+                int64_t mtime_ns{0};
+                int64_t ctime_ns{0};
+                uint32_t edge_crc{0};
+
+                bool operator==(const Key &other) const;
+                bool operator!=(const Key &other) const { return !(*this == other); }
+            };
+
+            /**
+             * @param path Bundle file.
+             * @param key Receives the identity.
+             * @return false if the file could not be read.
+             */
+            static bool identify(const std::string &path, Key &key);
+
+            /**
+             * @param key Identity of the bundle, taken before it is read.
+             * @param components Receives the components of the stored result.
+             * @return true if a verified result for exactly this identity exists.
+             */
+            static bool lookup(const Key &key, std::vector<BundleVerifier::Component> &components);
+
+            /**
+             * Replace the entry with a verified result.
+             * @param key Identity taken before verification; the caller checks it is unchanged.
+             * @param components Components of the verified bundle.
+             */
+            static void store(const Key &key, const std::vector<BundleVerifier::Component> &components);
+
+            /**
+             * Remove the entry.
+             */
+            static void invalidate();
+    };
+}
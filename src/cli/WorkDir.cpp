@@ -0,0 +1,220 @@
+#include "WorkDir.h"
+#include "Tracer.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr std::array<const char *, cli::WorkDir::ENTRY_COUNT> ENTRY_NAMES = {{
+        "update_type",
+        "update_version",
+        "update_size",
+        "update_location",
+        "downloadUpdate",
+        "installUpdate",
+        "applyUpdate",
+        "updateInstalled",
+        "rollbackUpdate",
+    }};
+
+    /* Kernel record of getdents64(2); older C libraries have no wrapper. */
+    struct linux_dirent64
+    {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    constexpr ssize_t SIZE_UNKNOWN = -2;
+    constexpr size_t DIRENT_MAX = sizeof(linux_dirent64) + NAME_MAX + 1;
+}
+
+const char *cli::WorkDir::name(Entry entry)
+{
+    return ENTRY_NAMES[entry];
+}
+
+bool cli::WorkDir::lookup(const std::string &file, Entry &entry)
+{
+    for (size_t i = 0; i < ENTRY_NAMES.size(); ++i)
+    {
+        if (file == ENTRY_NAMES[i])
+        {
+            entry = static_cast<Entry>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+cli::WorkDir::~WorkDir()
+{
+    this->close();
+}
+
+void cli::WorkDir::close()
+{
+    if (this->dir_fd >= 0)
+    {
+        ::close(this->dir_fd);
+        this->dir_fd = -1;
+    }
+    this->loaded = false;
+    this->scanned = false;
+    this->present.fill(false);
+}
+
+bool cli::WorkDir::is_loaded() const
+{
+    return this->loaded;
+}
+
+bool cli::WorkDir::refresh(const std::string &path)
+{
+    this->close();
+    this->loaded = true;
+    this->sizes.fill(SIZE_UNKNOWN);
+
+    this->dir_fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return this->dir_fd >= 0;
+}
+
+bool cli::WorkDir::scan()
+{
+    if (this->scanned)
+    {
+        return true;
+    }
+    this->scanned = true;
+    if (this->dir_fd < 0)
+    {
+        return false;
+    }
+
+
+    alignas(linux_dirent64) char buffer[4096];
+    for (;;)
+    {
+        const long n = ::syscall(SYS_getdents64, this->dir_fd, buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            if (errno == EINTR) { continue; }
+            this->present.fill(false);
+            return false;
+        }
+
+        for (long offset = 0; offset < n;)
+        {
+            const auto *record = reinterpret_cast<const linux_dirent64 *>(buffer + offset);
+            Entry entry;
+            if (record->d_name[0] != '.' && lookup(record->d_name, entry))
+            {
+                this->present[entry] = true;
+            }
+            offset += record->d_reclen;
+        }
+
+        /* The kernel only stops early when the next record does not fit, so
+         * room for a maximum-size record means the listing is complete.
+         */
+        if (sizeof(buffer) - static_cast<size_t>(n) >= DIRENT_MAX)
+        {
+            return true;
+        }
+    }
+}
+
+bool cli::WorkDir::exists(Entry entry)
+{
+    static_cast<void>(this->scan());
+    return this->present[entry];
+}
+
+ssize_t cli::WorkDir::size(Entry entry)
+{
+    if (!this->exists(entry))
+    {
+        return -1;
+    }
+    if (this->sizes[entry] == SIZE_UNKNOWN)
+    {
+        struct stat st;
+        this->sizes[entry] = (::fstatat(this->dir_fd, ENTRY_NAMES[entry], &st, 0) == 0)
+            ? static_cast<ssize_t>(st.st_size)
+            : -1;
+    }
+    return this->sizes[entry];
+}
+
+bool cli::WorkDir::read(Entry entry, std::string &out)
+{
+    out.clear();
+    if (this->scanned && !this->present[entry])
+    {
+        return false;
+    }
+
+    /* Without a listing the failing openat() is the existence check. */
+    const int fd = (this->dir_fd >= 0) ? ::openat(this->dir_fd, ENTRY_NAMES[entry], O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0)
+    {
+        return false;
+    }
+    this->present[entry] = true;
+
+    /* A regular file read is only short at end of file. */
+    char buffer[READ_MAX];
+    ssize_t n;
+    do
+    {
+        n = ::read(fd, buffer, sizeof(buffer));
+    } while (n < 0 && errno == EINTR);
+    ::close(fd);
+    if (n < 0)
+    {
+        return false;
+    }
+
+    size_t length = static_cast<size_t>(n);
+    if (length < sizeof(buffer))
+    {
+        this->sizes[entry] = n;
+    }
+    while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == '\r'))
+    {
+        --length;
+    }
+    out.assign(buffer, length);
+    return true;
+}
+
+bool cli::WorkDir::create_marker(Entry entry)
+{
+    FSCLI_TRACE_SPAN("create_marker");
+    if (this->dir_fd < 0)
+    {
+        return false;
+    }
+
+    const int fd = ::openat(this->dir_fd, ENTRY_NAMES[entry], O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 && errno != EEXIST)
+    {
+        return false;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        this->sizes[entry] = 0;
+    }
+    this->present[entry] = true;
+    return true;
+}
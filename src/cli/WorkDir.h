@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+namespace cli
+{
+    /**
+     * Index of the signal and metadata files in the update work directory.
+     * The directory is opened once with O_DIRECTORY. The first existence check
+     * lists it with a single getdents64 pass and later checks are answered from
+     * that snapshot. Files are read and created relative to the directory
+     * descriptor, so the work directory path is resolved only once.
+     */
+    class WorkDir
+    {
+        public:
+            enum Entry : uint8_t
+            {
+                UPDATE_TYPE,
+                UPDATE_VERSION,
+                UPDATE_SIZE,
+                UPDATE_LOCATION,
+                DOWNLOAD_UPDATE,
+                INSTALL_UPDATE,
+                APPLY_UPDATE,
+                UPDATE_INSTALLED,
+                ROLLBACK_UPDATE,
+                ENTRY_COUNT
+            };
+
+            /// Largest file read(); update_location holds a path.
+            static constexpr size_t READ_MAX = 4096;
+
+            /**
+             * @param entry Known work directory file.
+             * @return File name inside the work directory.
+             */
+            static const char *name(Entry entry);
+
+            /**
+             * @param file File name inside the work directory.
+             * @param entry Receives the matching entry.
+             * @return false if file is not a known work directory file.
+             */
+            static bool lookup(const std::string &file, Entry &entry);
+
+            WorkDir() = default;
+            ~WorkDir();
+
+            WorkDir(const WorkDir &) = delete;
+            WorkDir &operator=(const WorkDir &) = delete;
+
+            /**
+             * Open path. Drops an earlier snapshot, so a recreated directory is picked up.
+             * @param path Work directory.
+             * @return false if the directory could not be opened; all entries
+             *         are then reported missing.
+             */
+            bool refresh(const std::string &path);
+
+            /**
+             * Close the directory; the next refresh() reopens it.
+             */
+            void close();
+
+            /**
+             * @return true once refresh() has run since the last close().
+             */
+            bool is_loaded() const;
+
+            /**
+             * @return true if entry existed when the snapshot was taken or was created by create_marker().
+             */
+            bool exists(Entry entry);
+
+            /**
+             * Size of an existing entry; known after read(), else queried once with fstatat().
+             * @return Size in bytes, -1 if missing.
+             */
+            ssize_t size(Entry entry);
+
+            /**
+             * Read a small file through the directory descriptor.
+             * Trailing newlines are removed like posix_helpers::read_file().
+             * @param entry File to read.
+             * @param out Receives the content, at most READ_MAX bytes.
+             * @return false if the file is missing or could not be read.
+             */
+            bool read(Entry entry, std::string &out);
+
+            /**
+             * Create an empty marker file with O_EXCL.
+             * A marker created concurrently by another process counts as success.
+             * @return false if the marker could not be created.
+             */
+            bool create_marker(Entry entry);
+
+        private:
+            int dir_fd{-1};
+            bool loaded{false};
+            bool scanned{false};
+            std::array<bool, ENTRY_COUNT> present{};
+            std::array<ssize_t, ENTRY_COUNT> sizes{};
+
+            /**
+             * Take the getdents64 snapshot unless already done.
+             * @return false if the directory could not be listed.
+             */
+            bool scan();
+    };
+}
@@ -3,11 +3,27 @@
 #include "fs_updater_types.h"
 #include "posix_helpers.h"
 #include "cli_io.h"
+#include "cli_log.h"
+#include "DeltaPatch.h"
+#include "Metrics.h"
+#include "OutputReport.h"
+#include "ParallelInflate.h"
+#include "SpoolFile.h"
+#include "Tracer.h"
+#include "Prefetch.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <chrono>
+#include <thread>
 
 #include <fcntl.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <csignal>
 
@@ -16,6 +32,118 @@ constexpr char FSCLI_DOMAIN[] = "cli";
 constexpr uint32_t firmware_update_state = 0;
 constexpr uint32_t application_update_state = 1;
 
+constexpr char FW_ENV_CONFIG[] = "/etc/fw_env.config";
+
+/* One install progress line per second; sampling costs one /proc scan each. */
+constexpr std::chrono::milliseconds PROGRESS_INTERVAL{1000};
+
+/* ioprio_get(2)/ioprio_set(2) have no glibc wrapper; values from linux/ioprio.h. */
+constexpr int IOPRIO_WHO_PROCESS = 1;
+constexpr int IOPRIO_CLASS_SHIFT = 13;
+constexpr int IOPRIO_CLASS_BE = 2;
+constexpr int IOPRIO_CLASS_IDLE = 3;
+
+namespace
+{
+    /* "0,2-3" style list as used by taskset and cpuset. */
+    bool parse_cpu_list(const std::string &list, cpu_set_t &set)
+    {
+        CPU_ZERO(&set);
+        const char *next = list.c_str();
+        while (*next != '\0')
+        {
+            char *end = nullptr;
+            const unsigned long first = std::strtoul(next, &end, 10);
+            unsigned long last = first;
+            if (end == next)
+            {
+                return false;
+            }
+            if (*end == '-')
+            {
+                next = end + 1;
+                last = std::strtoul(next, &end, 10);
+                if (end == next || last < first)
+                {
+                    return false;
+                }
+            }
+            if (last >= CPU_SETSIZE)
+            {
+                return false;
+            }
+            for (unsigned long cpu = first; cpu <= last; ++cpu)
+            {
+                CPU_SET(cpu, &set);
+            }
+            if (*end == ',' && end[1] != '\0')
+            {
+                ++end;
+            }
+            else if (*end != '\0')
+            {
+                return false;
+            }
+            next = end;
+        }
+        return CPU_COUNT(&set) > 0;
+    }
+
+    /* Restores the I/O priority, nice value and CPU affinity of the calling
+     * thread. The daemon and --batch run further requests on the same
+     * thread, which must not inherit the limits of an earlier install.
+     */
+    class ResourceScope
+    {
+        public:
+            explicit ResourceScope(bool active)
+                : active(active)
+            {
+                if (!this->active)
+                {
+                    return;
+                }
+                this->io_priority = static_cast<int>(::syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0));
+                errno = 0;
+                this->nice = ::getpriority(PRIO_PROCESS, 0);
+                this->nice_saved = (errno == 0);
+                this->affinity_saved = ::sched_getaffinity(0, sizeof(this->affinity), &this->affinity) == 0;
+            }
+
+            ~ResourceScope()
+            {
+                if (!this->active)
+                {
+                    return;
+                }
+                /* Raising priority back needs CAP_SYS_NICE; the daemon runs as root. */
+                if (this->io_priority >= 0)
+                {
+                    static_cast<void>(::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, this->io_priority));
+                }
+                if (this->nice_saved)
+                {
+                    static_cast<void>(::setpriority(PRIO_PROCESS, 0, this->nice));
+                }
+                if (this->affinity_saved)
+                {
+                    static_cast<void>(::sched_setaffinity(0, sizeof(this->affinity), &this->affinity));
+                }
+            }
+
+            ResourceScope(const ResourceScope &) = delete;
+            ResourceScope &operator=(const ResourceScope &) = delete;
+
+        private:
+            bool active;
+            int io_priority{-1};
+            int nice{0};
+            bool nice_saved{false};
+            cpu_set_t affinity{};
+            bool affinity_saved{false};
+    };
+}
+
 using std::string;
 
 cli::fs_update_cli::fs_update_cli(int argc, const char ** argv):
@@ -25,7 +153,7 @@ cli::fs_update_cli::fs_update_cli(int argc, const char ** argv):
 		       "Path to update package",
 		       false,
 		       "",
-		       "absolute filesystem path"
+		       "absolute filesystem path, FIFO or - for stdin"
 		       ),
 		arg_update_type("",
 		       "update_type",
@@ -127,6 +255,127 @@ cli::fs_update_cli::fs_update_cli(int argc, const char ** argv):
 			    'a',
 				"accepted states: A or B"
 			    ),
+		arg_daemon("",
+			   "daemon",
+			   "Serve requests on a Unix socket with one persistent backend"
+			   ),
+		arg_client("",
+			   "client",
+			   "Forward the given action to a running daemon"
+			   ),
+		arg_socket("",
+			   "socket",
+			   "Unix socket path for --daemon and --client",
+			   false,
+			   FUS_CLI_DAEMON_SOCKET,
+			   "absolute filesystem path"
+			   ),
+		arg_batch("",
+			  "batch",
+			  "Run one command per line from file (or - for stdin) with a shared backend",
+			  false,
+			  "",
+			  "filesystem path or -"
+			  ),
+		arg_watch("",
+			  "watch",
+			  "With --download_progress: keep running and print a line per change until the download ends"
+			  ),
+		arg_watch_interval("",
+			  "watch_interval",
+			  "Minimum time between two --watch lines",
+			  false,
+			  1000U,
+			  "milliseconds"
+			  ),
+		arg_wait_for("",
+			  "wait_for",
+			  "Wait until the given signal file exists in the work directory",
+			  false,
+			  "",
+			  "signal file name, e.g. installUpdate"
+			  ),
+		arg_timeout("",
+			  "timeout",
+			  "Maximum wait of --wait_for, 0 waits without limit",
+			  false,
+			  0U,
+			  "milliseconds"
+			  ),
+		arg_check_integrity("",
+			  "check_integrity",
+			  "Check the SHA-256 of every bundle component against fsupdate.json "\
+			  "without installing it; signatures are not checked",
+			  false,
+			  "",
+			  "filesystem path"
+			  ),
+		arg_no_verify_cache("",
+			  "no_verify_cache",
+			  "With --check_integrity: read the bundle even if an unchanged file was verified before"
+			  ),
+		arg_progress_file("",
+			  "progress_file",
+			  "With --update_file or --automatic: also write install progress lines here",
+			  false,
+			  "",
+			  "file, FIFO or /dev/fd/<n>"
+			  ),
+		arg_trace("",
+			  "trace",
+			  "Write the duration of the significant calls as Chrome trace-event JSON",
+			  false,
+			  "",
+			  "filesystem path"
+			  ),
+		arg_max_write_mbps("",
+			  "max_write_mbps",
+			  "With --update_file or --automatic: cap the write rate of spooled, inflated and delta updates",
+			  false,
+			  0U,
+			  "MiB/s"
+			  ),
+		arg_io_class("",
+			  "io_class",
+			  "With --update_file or --automatic: I/O priority of the install",
+			  false,
+			  "",
+			  "idle, low or normal"
+			  ),
+		arg_cpu_affinity("",
+			  "cpu_affinity",
+			  "With --update_file or --automatic: CPUs the install and its threads may run on",
+			  false,
+			  "",
+			  "CPU list, e.g. 2-3 or 0,2"
+			  ),
+		arg_nice("",
+			  "nice",
+			  "With --update_file or --automatic: nice value of the install and its threads",
+			  false,
+			  0,
+			  "-20 to 19"
+			  ),
+		arg_adaptive_pacing("",
+			  "adaptive_pacing",
+			  "With --max_write_mbps: lower the cap while /proc/pressure reports I/O or CPU stalls"
+			  ),
+		arg_status("",
+			  "status",
+			  "Print reboot state, versions, slot bad flags and work directory signal files in one call"
+			  ),
+		arg_output("",
+			  "output",
+			  "Result format: text, or json for one JSON object per command on stdout",
+			  false,
+			  "text",
+			  "json or text"
+			  ),
+		env_snapshot([this]() -> fs::FSUpdate & {
+				this->require_backend(Backend::FSUPDATE);
+				return *this->update_handler;
+			},
+			[this]() -> UBoot::UBoot & { return this->uboot_env(); }),
 		return_code(0)
 {
     this->cmd.add(arg_update);
@@ -150,12 +399,40 @@ cli::fs_update_cli::fs_update_cli(int argc, const char ** argv):
     this->cmd.add(is_app_state_bad);
     this->cmd.add(set_fw_state_bad);
     this->cmd.add(is_fw_state_bad);
+    this->cmd.add(arg_daemon);
+    this->cmd.add(arg_client);
+    this->cmd.add(arg_socket);
+    this->cmd.add(arg_batch);
+    this->cmd.add(arg_watch);
+    this->cmd.add(arg_watch_interval);
+    this->cmd.add(arg_wait_for);
+    this->cmd.add(arg_timeout);
+    this->cmd.add(arg_check_integrity);
+    this->cmd.add(arg_no_verify_cache);
+    this->cmd.add(arg_progress_file);
+    this->cmd.add(arg_trace);
+    this->cmd.add(arg_max_write_mbps);
+    this->cmd.add(arg_io_class);
+    this->cmd.add(arg_cpu_affinity);
+    this->cmd.add(arg_nice);
+    this->cmd.add(arg_adaptive_pacing);
+    this->cmd.add(arg_status);
+    this->cmd.add(arg_output);
 
     this->parse_input(argc, argv);
 }
 
 cli::fs_update_cli::~fs_update_cli()
 {
+    /* The logger handler may outlive this object; write out queued serial lines now. */
+    if (this->serial_sink)
+    {
+        this->serial_sink->flush();
+    }
+    if (this->progress_fd >= 0)
+    {
+        ::close(this->progress_fd);
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -168,30 +445,233 @@ void cli::fs_update_cli::setup_logging()
     const auto level = this->arg_debug.isSet()
         ? logger::logLevel::DEBUG
         : logger::logLevel::WARNING;
+    this->log_level = level;
+
+    if (this->arg_debug.isSet() && !cli_log::compiled_in(logger::logLevel::DEBUG))
+    {
+        cli_io::write_stderr("Debug log entries are not compiled in (FUS_CLI_MIN_LOG_LEVEL)\n");
+    }
 
     if (is_automatic)
     {
         this->serial_cout = std::make_shared<SynchronizedSerial>();
-        this->logger_sink = std::make_unique<logger::LoggerSinkSerial>(level, serial_cout);
+        this->serial_sink = std::make_shared<logger::LoggerSinkSerial>(level, serial_cout);
+        this->logger_sink = this->serial_sink;
+
+        if (this->arg_debug.isSet())
+        {
+            cli_io::write_stderr("Serial console " + this->serial_cout->getDevice() + " ("
+                + this->serial_cout->getSource() + ") ready in "
+                + std::to_string(this->serial_cout->getSetupTime().count()) + " us\n");
+        }
     }
     else
     {
-        this->logger_sink = std::make_shared<logger::LoggerSinkStdout>(level);
+        /* With --output json stdout carries only the JSON result. The daemon
+         * and --batch build the sink once for all requests, whatever their
+         * --output, and the daemon's fd 1 is the current client's stdout.
+         */
+        const bool to_stderr = (this->arg_output.getValue() == "json") || this->arg_daemon.isSet() ||
+            this->serving_requests;
+        const int log_fd = to_stderr ? STDERR_FILENO : STDOUT_FILENO;
+        this->logger_sink = std::make_shared<logger::LoggerSinkConsole>(level, log_fd);
     }
 
     this->logger_handler = logger::LoggerHandler::initLogger(this->logger_sink);
-    this->update_handler = std::make_unique<fs::FSUpdate>(logger_handler);
+}
+
+void cli::fs_update_cli::require_backend(Backend level)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const char *name = "none";
+
+    switch (level)
+    {
+        case Backend::NONE:
+            break;
+        case Backend::WORK_DIR:
+            name = "work_dir";
+            static_cast<void>(this->work_dir_state());
+            break;
+        case Backend::UBOOT_ENV:
+            /* Read on demand through env_snapshot */
+            name = "uboot_env";
+            break;
+        case Backend::FSUPDATE:
+            name = "fsupdate";
+            if (!this->update_handler)
+            {
+                FSCLI_TRACE_SPAN("fsupdate_init");
+                this->setup_logging();
+                this->update_handler = std::make_unique<fs::FSUpdate>(logger_handler);
+            }
+            break;
+    }
+
+    if (this->arg_debug.isSet())
+    {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        cli_io::write_stderr(string("Backend ") + name + " ready in "
+            + std::to_string(elapsed.count()) + " us\n");
+    }
+}
+
+const string &cli::fs_update_cli::work_dir()
+{
+    if (this->work_dir_path.empty())
+    {
+        this->work_dir_path = this->update_handler
+            ? this->update_handler->get_work_dir().string()
+            : string(FUS_CLI_WORK_DIR);
+    }
+    return this->work_dir_path;
+}
+
+cli::WorkDir &cli::fs_update_cli::work_dir_state()
+{
+    if (!this->work_dir_index.is_loaded())
+    {
+        static_cast<void>(this->work_dir_index.refresh(this->work_dir()));
+    }
+    return this->work_dir_index;
+}
+
+UBoot::UBoot &cli::fs_update_cli::uboot_env()
+{
+    if (!this->uboot_handler)
+    {
+        this->uboot_handler = std::make_unique<UBoot::UBoot>(FW_ENV_CONFIG);
+    }
+    return *this->uboot_handler;
 }
 
 // ---------------------------------------------------------------------------
 // Shared helpers
 // ---------------------------------------------------------------------------
 
+/* Set before any thread is started: nice, I/O priority and affinity are
+ * per thread on Linux and inherited by new threads. update_image() runs on
+ * this thread; RAUC writes the firmware slot in its own process and keeps
+ * its own settings.
+ */
+bool cli::fs_update_cli::apply_resource_limits()
+{
+    const auto invalid = [this](const string &message) {
+        cli_io::write_stderr(message + "\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::INVALID_RESOURCE_LIMIT);
+        return false;
+    };
+
+    if (this->arg_io_class.isSet())
+    {
+        const string &io_class = this->arg_io_class.getValue();
+        int priority = -1;
+        if (io_class == "idle")
+        {
+            priority = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+        }
+        else if (io_class == "low")
+        {
+            priority = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;
+        }
+        else if (io_class == "normal")
+        {
+            priority = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 4;
+        }
+        if (priority < 0)
+        {
+            return invalid("--io_class must be idle, low or normal");
+        }
+        if (::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority) != 0)
+        {
+            return invalid(string("Setting I/O priority failed: ") + std::strerror(errno));
+        }
+    }
+
+    if (this->arg_nice.isSet())
+    {
+        const int nice = this->arg_nice.getValue();
+        if (nice < -20 || nice > 19)
+        {
+            return invalid("--nice must be between -20 and 19");
+        }
+        if (::setpriority(PRIO_PROCESS, 0, nice) != 0)
+        {
+            return invalid(string("Setting nice value failed: ") + std::strerror(errno));
+        }
+    }
+
+    if (this->arg_cpu_affinity.isSet())
+    {
+        cpu_set_t set;
+        if (!parse_cpu_list(this->arg_cpu_affinity.getValue(), set))
+        {
+            return invalid("--cpu_affinity must be a CPU list such as 2-3 or 0,2");
+        }
+        if (::sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            return invalid(string("Setting CPU affinity failed: ") + std::strerror(errno));
+        }
+    }
+
+    if (this->arg_max_write_mbps.isSet())
+    {
+        if (this->arg_max_write_mbps.getValue() == 0U)
+        {
+            return invalid("--max_write_mbps must be at least 1");
+        }
+        this->throttle = std::make_unique<Throttle>(
+            static_cast<uint64_t>(this->arg_max_write_mbps.getValue()) << 20U, this->arg_adaptive_pacing.isSet());
+    }
+    return true;
+}
+
+void cli::fs_update_cli::report_throughput(const string &update_file, std::chrono::milliseconds elapsed)
+{
+    struct stat st{};
+    if (::stat(update_file.c_str(), &st) == 0 && elapsed.count() > 0)
+    {
+        const auto rate = static_cast<uint64_t>(st.st_size) * 1000U / static_cast<uint64_t>(elapsed.count());
+        cli_io::write_stderr("Install: " + std::to_string(st.st_size) + " bytes in " + std::to_string(elapsed.count())
+            + " ms, " + std::to_string(rate >> 10U) + " KiB/s\n");
+    }
+    if (this->throttle && this->throttle->bytes() > 0U)
+    {
+        cli_io::write_stderr("Write cap: " + std::to_string(this->throttle->achieved() >> 10U) + " KiB/s achieved of "
+            + std::to_string(this->throttle->cap() >> 10U) + " KiB/s, " + std::to_string(this->throttle->bytes())
+            + " bytes paced, " + std::to_string(this->throttle->waited_ms()) + " ms waited, lowest adaptive cap "
+            + std::to_string(this->throttle->lowest() >> 10U) + " KiB/s\n");
+    }
+}
+
+void cli::fs_update_cli::create_work_dir()
+{
+    FSCLI_TRACE_SPAN("create_work_dir");
+    this->update_handler->create_work_dir();
+}
+
+void cli::fs_update_cli::rollback_slot(bool firmware)
+{
+    const auto env_start = std::chrono::steady_clock::now();
+    if (firmware)
+    {
+        FSCLI_TRACE_SPAN("rollback_firmware");
+        this->update_handler->rollback_firmware();
+    }
+    else
+    {
+        FSCLI_TRACE_SPAN("rollback_application");
+        this->update_handler->rollback_application();
+    }
+    this->env_snapshot.count_write(env_start);
+}
+
 bool cli::fs_update_cli::create_rollback_marker()
 {
-    const string work_dir = this->update_handler->get_work_dir().string();
-    const string marker = posix_helpers::path_join(work_dir, "rollbackUpdate");
-    if (!posix_helpers::create_marker_file(marker.c_str()))
+    /* create_work_dir() has just replaced the directory; reopen it. */
+    static_cast<void>(this->work_dir_index.refresh(this->work_dir()));
+    if (!this->work_dir_index.create_marker(WorkDir::ROLLBACK_UPDATE))
     {
         cli_io::write_stderr("Failed to create rollback marker file\n");
         return false;
@@ -205,6 +685,8 @@ bool cli::fs_update_cli::create_rollback_marker()
 
 void cli::fs_update_cli::update_image_state(const string &update_file)
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     try
     {
         cli_io::write_stdout("Update started\n");
@@ -217,12 +699,72 @@ void cli::fs_update_cli::update_image_state(const string &update_file)
             {
                 cli_io::write_stderr("Update type: " + update_type + " does not exist.\n");
                 this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::INVALID_UPDATE_TYPE);
+                this->end_progress("failed");
                 return;
             }
         }
 
+        /* The library reads the update file while verifying and extracting
+         * it, then reads the extracted application image to write the slot.
+         */
+        ProgressMonitor &monitor = this->begin_progress();
+        monitor.add_phase("extract", update_file, ProgressMonitor::Access::READ);
+        monitor.add_phase("write_app", this->update_handler->getTempAppPath().string(), ProgressMonitor::Access::READ);
+
+        if (this->prefetch && this->arg_debug.isSet())
+        {
+            uint64_t resident = 0U;
+            uint64_t total = 0U;
+            if (this->prefetch->cached(resident, total) && total > 0U)
+            {
+                cli_io::write_stderr("Prefetch: " + std::to_string(resident >> 20U) + " of "
+                    + std::to_string(total >> 20U) + " MiB (" + std::to_string((resident * 100U) / total)
+                    + "%) in page cache at install start\n");
+            }
+        }
+        /* The library reads the file itself from here on; the prefetch
+         * descriptor would otherwise show up as a second reader at offset 0.
+         */
+        this->prefetch.reset();
+
         string mutable_file = update_file;
-        this->update_handler->update_image(mutable_file, update_type, installed_update_type);
+        FSCLI_LOG_DEBUG("Installing " + update_file + " (type: " + (update_type.empty() ? "auto" : update_type) + ")");
+        const auto install_start = std::chrono::steady_clock::now();
+        {
+            FSCLI_TRACE_SPAN("update_image");
+            this->update_handler->update_image(mutable_file, update_type, installed_update_type);
+        }
+        FSCLI_LOG_DEBUG("Installed update type " + std::to_string(installed_update_type));
+
+        const auto install_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - install_start);
+        if (this->arg_debug.isSet())
+        {
+            cli_io::write_stderr("Update type " + std::to_string(installed_update_type) + " installed in "
+                + std::to_string(install_elapsed.count()) + " ms\n");
+        }
+        if (this->arg_debug.isSet() || this->arg_max_write_mbps.isSet())
+        {
+            this->report_throughput(update_file, install_elapsed);
+        }
+        if (this->metrics != nullptr)
+        {
+            struct stat st{};
+            const double seconds = static_cast<double>(install_elapsed.count()) / 1000.0;
+            this->metrics->set("fs_updater_install_duration_seconds", seconds);
+            if (::stat(update_file.c_str(), &st) == 0)
+            {
+                this->metrics->set("fs_updater_install_bytes", static_cast<double>(st.st_size));
+                if (seconds > 0.0)
+                {
+                    this->metrics->set("fs_updater_install_throughput_bytes_per_second",
+                        static_cast<double>(st.st_size) / seconds);
+                }
+            }
+        }
+
+        this->report->set("installed_update_type", static_cast<uint64_t>(installed_update_type));
+        this->report->set("duration_ms", static_cast<uint64_t>(install_elapsed.count()));
 
         switch(installed_update_type)
         {
@@ -239,6 +781,7 @@ void cli::fs_update_cli::update_image_state(const string &update_file)
             this->return_code = static_cast<int>(UPDATER_FIRMWARE_AND_APPLICATION_STATE::UPDATE_PROGRESS_ERROR);
         }
 
+        this->end_progress("done");
         cli_io::write_stdout("Image update successful\n");
     }
     catch (const fs::UpdateInProgress &e)
@@ -263,6 +806,62 @@ void cli::fs_update_cli::update_image_state(const string &update_file)
         cli_io::write_stderr(string("Image update system error: ") + e.what() + "\n");
         this->return_code = static_cast<int>(UPDATER_FIRMWARE_AND_APPLICATION_STATE::UPDATE_SYSTEM_ERROR);
     }
+    this->end_progress("failed");
+}
+
+cli::ProgressMonitor &cli::fs_update_cli::begin_progress()
+{
+    if (!this->progress)
+    {
+        if (this->arg_progress_file.isSet())
+        {
+            /* O_NONBLOCK: a reader that stops draining a pipe must not stall the install. */
+            const string &target = this->arg_progress_file.getValue();
+            this->progress_fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC, 0644);
+            if (this->progress_fd < 0)
+            {
+                cli_io::write_stderr("Cannot open progress file " + target + ": " + std::strerror(errno) + "\n");
+            }
+        }
+
+        /* The monitor thread must not write into the JSON result. */
+        const bool to_stderr = (this->report != nullptr) && this->report->json();
+        this->progress = std::make_unique<ProgressMonitor>(PROGRESS_INTERVAL, [this, to_stderr](const string &line) {
+            if (this->serial_cout)
+            {
+                this->serial_cout->write(line);
+            }
+            else if (to_stderr)
+            {
+                cli_io::write_stderr(line);
+            }
+            else
+            {
+                cli_io::write_stdout(line);
+            }
+            if (this->progress_fd >= 0)
+            {
+                static_cast<void>(::write(this->progress_fd, line.data(), line.size()));
+            }
+        });
+    }
+    this->progress->start();
+    return *this->progress;
+}
+
+void cli::fs_update_cli::end_progress(const char *result)
+{
+    if (!this->progress)
+    {
+        return;
+    }
+    this->progress->finish(result);
+    this->progress.reset();
+    if (this->progress_fd >= 0)
+    {
+        ::close(this->progress_fd);
+        this->progress_fd = -1;
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -271,9 +870,18 @@ void cli::fs_update_cli::update_image_state(const string &update_file)
 
 void cli::fs_update_cli::commit_update()
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     try
     {
-        if (this->update_handler->commit_update() == true)
+        bool committed = false;
+        {
+            FSCLI_TRACE_SPAN("commit_update");
+            const auto env_start = std::chrono::steady_clock::now();
+            committed = this->update_handler->commit_update();
+            this->env_snapshot.count_write(env_start);
+        }
+        if (committed)
         {
             cli_io::write_stdout("Commit update\n");
             this->return_code = static_cast<int>(UPDATER_COMMIT_STATE::UPDATE_COMMIT_SUCCESSFUL);
@@ -302,28 +910,30 @@ void cli::fs_update_cli::commit_update()
 
 void cli::fs_update_cli::rollback_update()
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     try
     {
         const update_definitions::UBootBootstateFlags update_reboot_state =
-            this->update_handler->get_update_reboot_state();
+            this->env_snapshot.reboot_state();
 
-        this->update_handler->create_work_dir();
+        this->create_work_dir();
 
         if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_APP_FW_UPDATE)
         {
             cli_io::write_stdout("Start application and firmware rollback\n");
-            this->update_handler->rollback_application();
-            this->update_handler->rollback_firmware();
+            this->rollback_slot(false);
+            this->rollback_slot(true);
         }
         else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_FW_UPDATE)
         {
             cli_io::write_stdout("Start firmware rollback\n");
-            this->update_handler->rollback_firmware();
+            this->rollback_slot(true);
         }
         else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_APP_UPDATE)
         {
             cli_io::write_stdout("Rollback application start\n");
-            this->update_handler->rollback_application();
+            this->rollback_slot(false);
         }
         else
         {
@@ -363,10 +973,12 @@ void cli::fs_update_cli::rollback_update()
 
 void cli::fs_update_cli::switch_firmware_slot()
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     try
     {
         const update_definitions::UBootBootstateFlags update_reboot_state =
-            this->update_handler->get_update_reboot_state();
+            this->env_snapshot.reboot_state();
         if (update_reboot_state != update_definitions::UBootBootstateFlags::NO_UPDATE_REBOOT_PENDING)
         {
             cli_io::write_stdout("Switch firmware slot is not allowed because update reboot state is wrong.\n");
@@ -375,8 +987,8 @@ void cli::fs_update_cli::switch_firmware_slot()
         else
         {
             cli_io::write_stdout("Start switch firmware slot\n");
-            this->update_handler->create_work_dir();
-            this->update_handler->rollback_firmware();
+            this->create_work_dir();
+            this->rollback_slot(true);
             if (!this->create_rollback_marker())
             {
                 this->return_code = static_cast<int>(UPDATER_UPDATE_ROLLBACK_STATE::UPDATE_ROLLBACK_PROGRESS_ERROR);
@@ -416,10 +1028,12 @@ void cli::fs_update_cli::switch_firmware_slot()
 
 void cli::fs_update_cli::switch_application_slot()
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     try
     {
         const update_definitions::UBootBootstateFlags update_reboot_state =
-            this->update_handler->get_update_reboot_state();
+            this->env_snapshot.reboot_state();
         if (update_reboot_state != update_definitions::UBootBootstateFlags::NO_UPDATE_REBOOT_PENDING)
         {
             cli_io::write_stdout("Switch application slot is not allowed because update reboot state is wrong.\n");
@@ -428,8 +1042,8 @@ void cli::fs_update_cli::switch_application_slot()
         else
         {
             cli_io::write_stdout("Start switch application slot\n");
-            this->update_handler->create_work_dir();
-            this->update_handler->rollback_application();
+            this->create_work_dir();
+            this->rollback_slot(false);
             if (!this->create_rollback_marker())
             {
                 this->return_code = static_cast<int>(UPDATER_UPDATE_ROLLBACK_STATE::UPDATE_ROLLBACK_PROGRESS_ERROR);
@@ -473,139 +1087,141 @@ void cli::fs_update_cli::switch_application_slot()
 
 void cli::fs_update_cli::print_update_reboot_state()
 {
-    const update_definitions::UBootBootstateFlags update_reboot_state = this->update_handler->get_update_reboot_state();
+    const char *message = nullptr;
+    this->return_code = static_cast<int>(this->resolve_reboot_state(message));
+    this->report->set("reboot_state_text", message);
+    cli_io::write_stdout(string(message) + "\n");
+}
+
+UPDATER_UPDATE_REBOOT_STATE cli::fs_update_cli::resolve_reboot_state(const char *&message)
+{
+    const update_definitions::UBootBootstateFlags update_reboot_state = this->env_snapshot.reboot_state();
 
     if (update_reboot_state == update_definitions::UBootBootstateFlags::FAILED_APP_UPDATE)
     {
-        cli_io::write_stdout("Application update failed\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::FAILED_APP_UPDATE);
+        message = "Application update failed";
+        return UPDATER_UPDATE_REBOOT_STATE::FAILED_APP_UPDATE;
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::FAILED_FW_UPDATE)
     {
-        cli_io::write_stdout("Firmware update failed\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::FAILED_FW_UPDATE);
+        message = "Firmware update failed";
+        return UPDATER_UPDATE_REBOOT_STATE::FAILED_FW_UPDATE;
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::FW_UPDATE_REBOOT_FAILED)
     {
-        cli_io::write_stdout("Firmware reboot update failed\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::FW_UPDATE_REBOOT_FAILED);
+        message = "Firmware reboot update failed";
+        return UPDATER_UPDATE_REBOOT_STATE::FW_UPDATE_REBOOT_FAILED;
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_FW_UPDATE)
     {
-        if (this->update_handler->is_reboot_complete(true))
+        if (this->env_snapshot.reboot_complete(true))
         {
-            cli_io::write_stdout("Incomplete firmware update. Commit required.\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_FW_UPDATE);
+            message = "Incomplete firmware update. Commit required.";
+            return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_FW_UPDATE;
         }
         else
         {
-            cli_io::write_stdout("Missing reboot after firmware update requested\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::UPDATE_REBOOT_PENDING);
+            message = "Missing reboot after firmware update requested";
+            return UPDATER_UPDATE_REBOOT_STATE::UPDATE_REBOOT_PENDING;
         }
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_APP_UPDATE)
     {
-        if (this->update_handler->is_reboot_complete(false))
+        if (this->env_snapshot.reboot_complete(false))
         {
-            cli_io::write_stdout("Incomplete application update. Commit required.\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_UPDATE);
+            message = "Incomplete application update. Commit required.";
+            return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_UPDATE;
         }
         else
         {
-            cli_io::write_stdout("Missing reboot after application update requested\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::UPDATE_REBOOT_PENDING);
+            message = "Missing reboot after application update requested";
+            return UPDATER_UPDATE_REBOOT_STATE::UPDATE_REBOOT_PENDING;
         }
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_APP_FW_UPDATE)
     {
-        if (this->update_handler->is_reboot_complete(true))
+        if (this->env_snapshot.reboot_complete(true))
         {
-            cli_io::write_stdout("Incomplete application and firmware update. Commit required.\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_FW_UPDATE);
+            message = "Incomplete application and firmware update. Commit required.";
+            return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_FW_UPDATE;
         }
         else
         {
-            cli_io::write_stdout("Missing reboot after application and firmware update\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::UPDATE_REBOOT_PENDING);
+            message = "Missing reboot after application and firmware update";
+            return UPDATER_UPDATE_REBOOT_STATE::UPDATE_REBOOT_PENDING;
         }
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::ROLLBACK_FW_REBOOT_PENDING)
     {
-        if (this->update_handler->pendingUpdateRollback() == false)
+        if (this->env_snapshot.pending_rollback() == false)
         {
-            cli_io::write_stdout("Missing reboot after firmware rollback requested\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::ROLLBACK_FW_REBOOT_PENDING);
+            message = "Missing reboot after firmware rollback requested";
+            return UPDATER_UPDATE_REBOOT_STATE::ROLLBACK_FW_REBOOT_PENDING;
         }
         else
         {
-            cli_io::write_stdout("Incomplete firmware rollback. Commit requested.\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_FW_ROLLBACK);
+            message = "Incomplete firmware rollback. Commit requested.";
+            return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_FW_ROLLBACK;
         }
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::ROLLBACK_APP_REBOOT_PENDING)
     {
-        if (this->update_handler->pendingUpdateRollback() == false)
+        if (this->env_snapshot.pending_rollback() == false)
         {
-            cli_io::write_stdout("Missing reboot after application rollback requested\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::ROLLBACK_APP_REBOOT_PENDING);
+            message = "Missing reboot after application rollback requested";
+            return UPDATER_UPDATE_REBOOT_STATE::ROLLBACK_APP_REBOOT_PENDING;
         }
         else
         {
-            cli_io::write_stdout("Incomplete application rollback. Commit requested.\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_ROLLBACK);
+            message = "Incomplete application rollback. Commit requested.";
+            return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_ROLLBACK;
         }
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::ROLLBACK_APP_FW_REBOOT_PENDING)
     {
-        if (this->update_handler->pendingUpdateRollback() == false)
+        if (this->env_snapshot.pending_rollback() == false)
         {
-            cli_io::write_stdout("Missing reboot after firmware and application rollback requested\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::ROLLBACK_APP_FW_REBOOT_PENDING);
+            message = "Missing reboot after firmware and application rollback requested";
+            return UPDATER_UPDATE_REBOOT_STATE::ROLLBACK_APP_FW_REBOOT_PENDING;
         }
         else
         {
-            cli_io::write_stdout("Incomplete firmware and application rollback. Commit requested.\n");
-            this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_FW_ROLLBACK);
+            message = "Incomplete firmware and application rollback. Commit requested.";
+            return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_FW_ROLLBACK;
         }
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_FW_ROLLBACK)
     {
-        cli_io::write_stdout("Incomplete firmware rollback. Commit requested.\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_FW_ROLLBACK);
+        message = "Incomplete firmware rollback. Commit requested.";
+        return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_FW_ROLLBACK;
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_APP_ROLLBACK)
     {
-        cli_io::write_stdout("Incomplete application rollback. Commit requested.\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_ROLLBACK);
+        message = "Incomplete application rollback. Commit requested.";
+        return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_ROLLBACK;
     }
     else if (update_reboot_state == update_definitions::UBootBootstateFlags::INCOMPLETE_APP_FW_ROLLBACK)
     {
-        cli_io::write_stdout("Incomplete firmware and application rollback. Commit requested.\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_FW_ROLLBACK);
+        message = "Incomplete firmware and application rollback. Commit requested.";
+        return UPDATER_UPDATE_REBOOT_STATE::INCOMPLETE_APP_FW_ROLLBACK;
     }
     else
     {
-        cli_io::write_stdout("No update pending\n");
-        this->return_code = static_cast<int>(UPDATER_UPDATE_REBOOT_STATE::NO_UPDATE_REBOOT_PENDING);
+        message = "No update pending";
+        return UPDATER_UPDATE_REBOOT_STATE::NO_UPDATE_REBOOT_PENDING;
     }
 }
 
 void cli::fs_update_cli::print_current_application_version()
 {
-#if UPDATE_VERSION_TYPE_UINT64
-    cli_io::write_stdout(std::to_string(this->update_handler->get_application_version()) + "\n");
-#else
-    cli_io::write_stdout(this->update_handler->get_application_version() + "\n");
-#endif
+    this->report->set("application_version", this->env_snapshot.application_version());
+    cli_io::write_stdout(this->env_snapshot.application_version() + "\n");
 }
 
 void cli::fs_update_cli::print_current_firmware_version()
 {
-#if UPDATE_VERSION_TYPE_UINT64
-    cli_io::write_stdout(std::to_string(this->update_handler->get_firmware_version()) + "\n");
-#else
-    cli_io::write_stdout(this->update_handler->get_firmware_version() + "\n");
-#endif
+    this->report->set("firmware_version", this->env_snapshot.firmware_version());
+    cli_io::write_stdout(this->env_snapshot.firmware_version() + "\n");
 }
 
 // ---------------------------------------------------------------------------
@@ -614,6 +1230,8 @@ void cli::fs_update_cli::print_current_firmware_version()
 
 void cli::fs_update_cli::set_application_state_bad(const char &state)
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     this->return_code = static_cast<int>(UPDATER_SETGET_UPDATE_STATE::GETSET_STATE_SUCCESSFUL);
     if (this->update_handler->set_update_state_bad(state, application_update_state) == EINVAL)
         this->return_code = static_cast<int>(UPDATER_SETGET_UPDATE_STATE::PASSING_PARAM_UPDATE_STATE_WRONG);
@@ -628,12 +1246,16 @@ void cli::fs_update_cli::is_application_state_bad(const char &state)
     }
     else
     {
-        cli_io::write_stdout(std::to_string(this->update_handler->is_update_state_bad(state, application_update_state)) + "\n");
+        const bool bad = this->env_snapshot.slot_bad(state, true);
+        this->report->set("bad", bad);
+        cli_io::write_stdout(std::to_string(bad) + "\n");
     }
 }
 
 void cli::fs_update_cli::set_firmware_state_bad(const char &state)
 {
+    const auto env_write = this->env_snapshot.write_scope();
+
     this->return_code = static_cast<int>(UPDATER_SETGET_UPDATE_STATE::GETSET_STATE_SUCCESSFUL);
     if (this->update_handler->set_update_state_bad(state, firmware_update_state) == EINVAL)
         this->return_code = static_cast<int>(UPDATER_SETGET_UPDATE_STATE::PASSING_PARAM_UPDATE_STATE_WRONG);
@@ -648,7 +1270,9 @@ void cli::fs_update_cli::is_firmware_state_bad(const char &state)
     }
     else
     {
-        cli_io::write_stdout(std::to_string(this->update_handler->is_update_state_bad(state, firmware_update_state)) + "\n");
+        const bool bad = this->env_snapshot.slot_bad(state, false);
+        this->report->set("bad", bad);
+        cli_io::write_stdout(std::to_string(bad) + "\n");
     }
 }
 
@@ -660,20 +1284,273 @@ void cli::fs_update_cli::handle_update_file()
 {
     const string update_location = this->arg_update.getValue();
 
-    if (!posix_helpers::path_exists(update_location.c_str()))
+    if (update_location == "-")
+    {
+        this->update_from_stream(STDIN_FILENO, "stdin");
+        return;
+    }
+
+    struct stat st{};
+    if (::stat(update_location.c_str(), &st) != 0)
     {
         cli_io::write_stderr("Update file: " + update_location + " does not exist.\n");
         this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::UPDATE_FILE_NOT_FOUND);
         return;
     }
+
+    if (S_ISFIFO(st.st_mode))
+    {
+        const int fifo = ::open(update_location.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fifo < 0)
+        {
+            cli_io::write_stderr("Update file: " + update_location + " cannot be opened: "
+                + std::strerror(errno) + "\n");
+            this->return_code = static_cast<int>(UPDATER_SYSTEM::UPDATE_STREAM_FAILED);
+            return;
+        }
+        this->update_from_stream(fifo, update_location);
+        ::close(fifo);
+        return;
+    }
+    if (DeltaPatch::is_delta(update_location))
+    {
+        this->update_from_delta(update_location);
+        return;
+    }
+
+    /* A gzip file is inflated into a spool file like a compressed stream. */
+    const int file = ::open(update_location.c_str(), O_RDONLY | O_CLOEXEC);
+    uint8_t head[ParallelInflate::HEAD];
+    const ssize_t head_length = (file >= 0) ? ::pread(file, head, sizeof(head), 0) : -1;
+    if (head_length > 0 && ParallelInflate::is_gzip(head, static_cast<size_t>(head_length), update_location))
+    {
+        this->update_from_stream(file, update_location);
+        ::close(file);
+        return;
+    }
+    if (file >= 0)
+    {
+        ::close(file);
+    }
     this->update_image_state(update_location);
 }
 
+void cli::fs_update_cli::spool_finished(const BlockWriter &writer)
+{
+    if (this->metrics != nullptr)
+    {
+        this->metrics->set("fs_updater_spool_written_bytes", static_cast<double>(writer.written()));
+    }
+    if (this->arg_debug.isSet())
+    {
+        cli_io::write_stderr("Write: " + std::to_string(writer.written()) + " bytes written, "
+            + std::to_string(writer.sparse()) + " zero bytes left sparse\n");
+    }
+}
+
+string cli::fs_update_cli::spool_suffix()
+{
+    /* fs-updater-lib and RAUC pick the format from the file name. */
+    if (this->arg_update_type.isSet())
+    {
+        return (this->arg_update_type.getValue() == "fw") ? ".raucb" : "";
+    }
+    return ".fs";
+}
+
+void cli::fs_update_cli::update_from_stream(int source, const string &name)
+{
+    /* fs-updater-lib opens updates by path and RAUC needs a seekable bundle,
+     * so the stream is copied to persistent storage first. SpoolFile writes
+     * it back in fixed windows, which keeps the page cache it pins bounded.
+     */
+    SpoolFile spool(FUS_CLI_SPOOL_DIR, this->spool_suffix());
+    if (!spool.valid())
+    {
+        cli_io::write_stderr(string("Cannot create spool file in " FUS_CLI_SPOOL_DIR ": ")
+            + std::strerror(errno) + "\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::UPDATE_STREAM_FAILED);
+        return;
+    }
+    if (spool.on_tmpfs())
+    {
+        cli_io::write_stderr("Warning: " FUS_CLI_SPOOL_DIR " is a tmpfs, the update is held in RAM\n");
+    }
+    spool.set_throttle(this->throttle.get());
+
+    /* The first bytes tell a gzip-compressed update from a plain one. */
+    string head(ParallelInflate::HEAD, '\0');
+    size_t head_length = 0U;
+    while (head_length < head.size())
+    {
+        const ssize_t n = ::read(source, &head[head_length], head.size() - head_length);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { break; }
+        head_length += static_cast<size_t>(n);
+    }
+    head.resize(head_length);
+    const bool compressed = ParallelInflate::is_gzip(head.data(), head.size(), name);
+
+    this->begin_progress().add_phase(compressed ? "inflate" : "spool", spool.path(), ProgressMonitor::Access::WRITE);
+    FSCLI_LOG_DEBUG(string(compressed ? "Inflating" : "Spooling") + " update from " + name + " to " + spool.path());
+    const auto spool_start = std::chrono::steady_clock::now();
+    if (compressed)
+    {
+        /* One worker per core; the budget bounds the members in flight. */
+        ParallelInflate inflate(std::max(std::thread::hardware_concurrency(), 1U), FUS_CLI_INFLATE_BUDGET);
+        ParallelInflate::Result result;
+        {
+            FSCLI_TRACE_SPAN("inflate");
+            result = inflate.run(source, head, spool);
+        }
+        if (result != ParallelInflate::Result::DONE || !spool.finish())
+        {
+            cli_io::write_stderr("Decompressing update from " + name + " failed: "
+                + (inflate.error().empty() ? string(std::strerror(errno)) : inflate.error()) + "\n");
+            this->return_code = static_cast<int>(UPDATER_SYSTEM::UPDATE_STREAM_FAILED);
+            this->end_progress("failed");
+            return;
+        }
+        if (this->arg_debug.isSet())
+        {
+            cli_io::write_stderr("Inflated " + std::to_string(inflate.compressed()) + " bytes, "
+                + ((inflate.members() > 0U) ? std::to_string(inflate.members()) + " members on "
+                    + std::to_string(inflate.workers()) + " threads" : string("sequential")) + "\n");
+        }
+    }
+    else if (!spool.write(head.data(), head.size()) || !spool.copy_from(source) || !spool.finish())
+    {
+        cli_io::write_stderr("Reading update from " + name + " failed: " + std::strerror(errno) + "\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::UPDATE_STREAM_FAILED);
+        this->end_progress("failed");
+        return;
+    }
+    if (spool.size() == 0U)
+    {
+        this->end_progress("failed");
+        cli_io::write_stderr("Update stream " + name + " is empty\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::UPDATE_STREAM_FAILED);
+        return;
+    }
+
+    if (this->arg_debug.isSet())
+    {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - spool_start);
+        cli_io::write_stderr("Spooled " + std::to_string(spool.size()) + " bytes from " + name + " in "
+            + std::to_string(elapsed.count()) + " ms\n");
+    }
+    this->spool_finished(spool.stats());
+    if (DeltaPatch::is_delta(spool.path()))
+    {
+        this->update_from_delta(spool.path());
+        return;
+    }
+    this->update_image_state(spool.path());
+}
+
+void cli::fs_update_cli::update_from_delta(const string &delta)
+{
+    string slot;
+    try
+    {
+        slot = this->uboot_env().getVariable("application");
+    }
+    catch (const std::exception &e)
+    {
+        FSCLI_LOG_DEBUG(string("Reading application variable failed: ") + e.what());
+    }
+    if (slot != "A" && slot != "B")
+    {
+        cli_io::write_stderr("Delta update: active application slot unknown (application=" + slot + ")\n");
+        this->return_code = static_cast<int>(UPDATER_DELTA_STATE::DELTA_APPLY_FAILED);
+        return;
+    }
+
+    string source = FUS_CLI_APP_SLOT_PATH;
+    const string::size_type placeholder = source.find("%c");
+    if (placeholder != string::npos)
+    {
+        source.replace(placeholder, 2U, 1U, static_cast<char>(std::tolower(static_cast<unsigned char>(slot[0]))));
+    }
+
+    SpoolFile spool(FUS_CLI_SPOOL_DIR, this->spool_suffix());
+    if (!spool.valid())
+    {
+        cli_io::write_stderr(string("Cannot create spool file in " FUS_CLI_SPOOL_DIR ": ")
+            + std::strerror(errno) + "\n");
+        this->return_code = static_cast<int>(UPDATER_DELTA_STATE::DELTA_APPLY_FAILED);
+        return;
+    }
+    spool.set_throttle(this->throttle.get());
+
+    this->begin_progress().add_phase("patch", spool.path(), ProgressMonitor::Access::WRITE);
+    FSCLI_LOG_DEBUG("Rebuilding update from " + delta + " against " + source);
+    const auto patch_start = std::chrono::steady_clock::now();
+    DeltaPatch patch(delta, source);
+    DeltaPatch::Result result;
+    {
+        FSCLI_TRACE_SPAN("apply_delta");
+        result = patch.apply(spool);
+    }
+    if (result == DeltaPatch::Result::APPLIED && !spool.finish())
+    {
+        result = DeltaPatch::Result::IO_FAILED;
+    }
+    switch (result)
+    {
+        case DeltaPatch::Result::APPLIED:
+        break;
+        case DeltaPatch::Result::SOURCE_MISMATCH:
+        this->return_code = static_cast<int>(UPDATER_DELTA_STATE::DELTA_SOURCE_MISMATCH);
+        break;
+        case DeltaPatch::Result::TARGET_MISMATCH:
+        this->return_code = static_cast<int>(UPDATER_DELTA_STATE::DELTA_TARGET_MISMATCH);
+        break;
+        case DeltaPatch::Result::FORMAT_INVALID:
+        this->return_code = static_cast<int>(UPDATER_DELTA_STATE::DELTA_INVALID);
+        break;
+        default:
+        this->return_code = static_cast<int>(UPDATER_DELTA_STATE::DELTA_APPLY_FAILED);
+    }
+    if (result != DeltaPatch::Result::APPLIED)
+    {
+        this->end_progress("failed");
+        cli_io::write_stderr("Delta update failed: " + (patch.error().empty() ? string("writing ") + spool.path() : patch.error()) + "\n");
+        return;
+    }
+
+    if (this->arg_debug.isSet())
+    {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - patch_start);
+        cli_io::write_stderr("Delta: " + std::to_string(patch.copied()) + " bytes from slot " + slot + ", "
+            + std::to_string(patch.literal()) + " bytes from delta, rebuilt in "
+            + std::to_string(elapsed.count()) + " ms\n");
+    }
+    this->spool_finished(spool.stats());
+    this->update_image_state(spool.path());
+}
+
 void cli::fs_update_cli::handle_automatic()
 {
     const char *update_stick_env = std::getenv("UPDATE_STICK");
     const char *update_file_env = std::getenv("UPDATE_FILE");
 
+    /* Start reading the stick before the backend is built, so the slow
+     * medium is read while logger, serial console and fs::FSUpdate start.
+     */
+    string update_file;
+    if (update_stick_env != nullptr && update_file_env != nullptr)
+    {
+        update_file = posix_helpers::path_join(update_stick_env, update_file_env);
+        if (FUS_CLI_PREFETCH_WINDOW > 0U)
+        {
+            this->prefetch = std::make_unique<Prefetch>(update_file, FUS_CLI_PREFETCH_WINDOW);
+        }
+    }
+    this->require_backend(Backend::FSUPDATE);
+
     if (update_stick_env == nullptr)
     {
         this->serial_cout->write("Environment variable \"UPDATE_STICK\" is not set\n");
@@ -688,15 +1565,9 @@ void cli::fs_update_cli::handle_automatic()
         return;
     }
 
-    const string update_stick(update_stick_env);
-    string update_file = update_stick;
-    if (update_stick.back() != '/')
-    {
-        update_file += "/";
-    }
-    update_file += update_file_env;
-
+    FSCLI_LOG_DEBUG("Automatic update from " + update_file);
     this->update_image_state(update_file);
+    this->prefetch.reset();
 }
 
 void cli::fs_update_cli::handle_print_version()
@@ -705,34 +1576,75 @@ void cli::fs_update_cli::handle_print_version()
         + " build at: " + __DATE__ + ", " + __TIME__ + ".\n");
 }
 
-void cli::fs_update_cli::handle_is_update_available()
+/* Everything the separate queries report, from one environment snapshot
+ * and one work directory scan. Exit code as --update_reboot_state.
+ */
+void cli::fs_update_cli::handle_status()
 {
-    const string work_dir = this->update_handler->get_work_dir().string();
+    const char *message = nullptr;
+    const UPDATER_UPDATE_REBOOT_STATE state = this->resolve_reboot_state(message);
 
-    string updateType;
-    if (!posix_helpers::read_file(posix_helpers::path_join(work_dir, "update_type").c_str(), updateType))
+    string signals;
+    WorkDir &work_dir = this->work_dir_state();
+    for (uint8_t entry = 0; entry < WorkDir::ENTRY_COUNT; ++entry)
     {
-        cli_io::write_stdout("No updates have been found\n");
-        this->return_code = static_cast<int>(UPDATER_IS_UPDATE_AVAILABLE_STATE::NO_UPDATE_AVAILABLE);
-        return;
+        if (work_dir.exists(static_cast<WorkDir::Entry>(entry)))
+        {
+            signals += (signals.empty() ? "" : ",") + string(WorkDir::name(static_cast<WorkDir::Entry>(entry)));
+        }
     }
 
-    string updateVersion;
-    if (!posix_helpers::read_file(posix_helpers::path_join(work_dir, "update_version").c_str(), updateVersion))
-    {
-        cli_io::write_stdout("No updates have been found\n");
-        this->return_code = static_cast<int>(UPDATER_IS_UPDATE_AVAILABLE_STATE::NO_UPDATE_AVAILABLE);
-        return;
-    }
+    const char *category = nullptr;
+    const char *state_name = "UNKNOWN";
+    static_cast<void>(OutputReport::lookup(static_cast<int>(state), category, state_name));
+
+    this->report->set("reboot_state", static_cast<int64_t>(state));
+    this->report->set("reboot_state_name", state_name);
+    this->report->set("reboot_state_text", message);
+    this->report->set("firmware_version", this->env_snapshot.firmware_version());
+    this->report->set("application_version", this->env_snapshot.application_version());
+    this->report->set("firmware_a_bad", this->env_snapshot.slot_bad('A', false));
+    this->report->set("firmware_b_bad", this->env_snapshot.slot_bad('B', false));
+    this->report->set("application_a_bad", this->env_snapshot.slot_bad('A', true));
+    this->report->set("application_b_bad", this->env_snapshot.slot_bad('B', true));
+    this->report->set("work_dir", this->work_dir());
+    this->report->set("signals", signals);
+
+    string out;
+    out += "reboot_state=" + std::to_string(static_cast<int>(state)) + "\n";
+    out += string("reboot_state_name=") + state_name + "\n";
+    out += string("reboot_state_text=") + message + "\n";
+    out += "firmware_version=" + this->env_snapshot.firmware_version() + "\n";
+    out += "application_version=" + this->env_snapshot.application_version() + "\n";
+    out += "firmware_a_bad=" + std::to_string(this->env_snapshot.slot_bad('A', false)) + "\n";
+    out += "firmware_b_bad=" + std::to_string(this->env_snapshot.slot_bad('B', false)) + "\n";
+    out += "application_a_bad=" + std::to_string(this->env_snapshot.slot_bad('A', true)) + "\n";
+    out += "application_b_bad=" + std::to_string(this->env_snapshot.slot_bad('B', true)) + "\n";
+    out += "work_dir=" + this->work_dir() + "\n";
+    out += "signals=" + signals + "\n";
+    cli_io::write_stdout(out);
+    this->return_code = static_cast<int>(state);
+}
+
+void cli::fs_update_cli::handle_is_update_available()
+{
+    WorkDir &state = this->work_dir_state();
 
+    string updateType;
+    string updateVersion;
     string updateSize;
-    if (!posix_helpers::read_file(posix_helpers::path_join(work_dir, "update_size").c_str(), updateSize))
+    if (!state.read(WorkDir::UPDATE_TYPE, updateType) ||
+        !state.read(WorkDir::UPDATE_VERSION, updateVersion) ||
+        !state.read(WorkDir::UPDATE_SIZE, updateSize))
     {
         cli_io::write_stdout("No updates have been found\n");
         this->return_code = static_cast<int>(UPDATER_IS_UPDATE_AVAILABLE_STATE::NO_UPDATE_AVAILABLE);
         return;
     }
 
+    this->report->set("type", updateType);
+    this->report->set("version", updateVersion);
+    this->report->set("size", static_cast<uint64_t>(std::strtoull(updateSize.c_str(), nullptr, 10)));
     cli_io::write_stdout("A new update is available on the server\n");
     cli_io::write_stdout("Type: " + updateType + "\n");
     cli_io::write_stdout("Version: " + updateVersion + "\n");
@@ -755,22 +1667,21 @@ void cli::fs_update_cli::handle_is_update_available()
 
 void cli::fs_update_cli::handle_download_update()
 {
-    const string work_dir = this->update_handler->get_work_dir().string();
-    if (!posix_helpers::path_exists(posix_helpers::path_join(work_dir, "update_type").c_str()) ||
-        !posix_helpers::path_exists(posix_helpers::path_join(work_dir, "update_version").c_str()) ||
-        !posix_helpers::path_exists(posix_helpers::path_join(work_dir, "update_size").c_str()))
+    WorkDir &state = this->work_dir_state();
+    if (!state.exists(WorkDir::UPDATE_TYPE) ||
+        !state.exists(WorkDir::UPDATE_VERSION) ||
+        !state.exists(WorkDir::UPDATE_SIZE))
     {
         this->return_code = static_cast<int>(UPDATER_DOWNLOAD_UPDATE_STATE::NO_DOWNLOAD_QUEUED);
     }
-    else if (posix_helpers::path_exists(posix_helpers::path_join(work_dir, "downloadUpdate").c_str()))
+    else if (state.exists(WorkDir::DOWNLOAD_UPDATE))
     {
         cli_io::write_stdout("Download in progress...\n");
         this->return_code = static_cast<int>(UPDATER_DOWNLOAD_UPDATE_STATE::UPDATE_DOWNLOAD_STARTED_BEFORE);
     }
     else
     {
-        const string marker = posix_helpers::path_join(work_dir, "downloadUpdate");
-        if (!posix_helpers::create_marker_file(marker.c_str()))
+        if (!state.create_marker(WorkDir::DOWNLOAD_UPDATE))
         {
             cli_io::write_stdout("Could not initiate update download...\n");
             this->return_code = static_cast<int>(UPDATER_DOWNLOAD_UPDATE_STATE::UPDATE_DOWNLOAD_FAILED);
@@ -785,116 +1696,122 @@ void cli::fs_update_cli::handle_download_update()
 
 void cli::fs_update_cli::handle_download_progress()
 {
-    const string work_dir = this->update_handler->get_work_dir().string();
-    if (!posix_helpers::path_exists(posix_helpers::path_join(work_dir, "downloadUpdate").c_str()))
+    if (this->arg_watch.isSet())
     {
-        this->return_code = static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
+        this->watch_download_progress();
         return;
     }
 
-    uint64_t update_size = 0;
+    DownloadStatus status;
+    this->return_code = this->read_download_progress(status, true);
+    if (status.update_size > 0U)
+    {
+        this->report->set("loaded", status.loaded);
+        this->report->set("size", status.update_size);
+        this->report->set("percent", (status.loaded * 100U) / status.update_size);
+    }
+}
+
+int cli::fs_update_cli::read_download_progress(DownloadStatus &status, bool report)
+{
+    status = DownloadStatus{};
+    WorkDir &state = this->work_dir_state();
+    if (!state.exists(WorkDir::DOWNLOAD_UPDATE))
+    {
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
+    }
+
     string size_str;
-    const string size_path = posix_helpers::path_join(work_dir, "update_size");
-    if (!posix_helpers::read_file(size_path.c_str(), size_str))
+    if (!state.read(WorkDir::UPDATE_SIZE, size_str))
     {
-        cli_io::write_stdout("Update size not available: " + std::to_string(errno) + "\n");
-        this->return_code = static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
-        return;
+        if (report)
+            cli_io::write_stdout("Update size not available: " + std::to_string(errno) + "\n");
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
     }
     try
     {
-        update_size = std::stoull(size_str);
+        status.update_size = std::stoull(size_str);
     }
     catch (const std::exception &)
     {
-        cli_io::write_stderr("Update size file contains invalid data\n");
-        this->return_code = static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
-        return;
+        if (report)
+            cli_io::write_stderr("Update size file contains invalid data\n");
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
     }
 
-    if (update_size == 0)
+    if (status.update_size == 0)
     {
-        this->return_code = static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
-        return;
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
     }
 
-    const string update_location = posix_helpers::path_join(work_dir, "update_location");
-    const ssize_t loc_size = posix_helpers::file_size(update_location.c_str());
+    /* Reading first gives the size without another stat. */
+    const bool location_read = state.read(WorkDir::UPDATE_LOCATION, status.target);
+    const ssize_t loc_size = state.size(WorkDir::UPDATE_LOCATION);
 
     if (loc_size < 0 || loc_size <= 9)
     {
-        cli_io::write_stdout("Waiting to start download.\n");
-        this->return_code =
-            static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START);
-        return;
+        if (report)
+            cli_io::write_stdout("Waiting to start download.\n");
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START);
     }
 
-    string update_file_path;
-    if (!posix_helpers::read_file(update_location.c_str(), update_file_path))
+    if (!location_read)
     {
-        this->return_code =
-            static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START);
-        return;
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START);
     }
 
-    if (!posix_helpers::path_exists(update_file_path.c_str()))
+    const ssize_t filesize_s = posix_helpers::file_size(status.target.c_str());
+    if (filesize_s < 0)
     {
-        cli_io::write_stderr("Update file: " + update_file_path + " does not exist.\n");
-        this->return_code =
-            static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START);
-        return;
+        if (report)
+            cli_io::write_stderr("Update file: " + status.target + " does not exist.\n");
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START);
     }
 
-    const ssize_t filesize_s = posix_helpers::file_size(update_file_path.c_str());
-    if (filesize_s <= 0)
+    if (filesize_s == 0)
     {
-        if (filesize_s == 0)
+        if (report)
             cli_io::write_stdout("Size of loaded update: 0...\n");
-        this->return_code = static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
-        return;
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED);
     }
 
-    const uint64_t filesize = static_cast<uint64_t>(filesize_s);
-    cli_io::write_stdout("Size of loaded update: " + std::to_string(filesize) + "...\n");
+    status.loaded = static_cast<uint64_t>(filesize_s);
+    const int percent = static_cast<int>((status.loaded * 100U) / status.update_size);
 
-    const int percent = static_cast<int>((filesize * 100U) / update_size);
-
-    cli_io::write_stdout(std::to_string(filesize) + "/" + std::to_string(update_size) + " -- " + std::to_string(percent) + "%\n");
-
-    if (percent < 100)
+    if (report)
     {
-        this->return_code =
-            static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_IN_PROGRESS);
+        cli_io::write_stdout("Size of loaded update: " + std::to_string(status.loaded) + "...\n");
+        cli_io::write_stdout(std::to_string(status.loaded) + "/" + std::to_string(status.update_size) + " -- " + std::to_string(percent) + "%\n");
     }
-    else
+
+    if (percent < 100)
     {
-        this->return_code =
-            static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_FINISHED);
+        return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_IN_PROGRESS);
     }
+    return static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_FINISHED);
 }
 
 void cli::fs_update_cli::handle_install_update()
 {
-    const string work_dir = this->update_handler->get_work_dir().string();
+    WorkDir &state = this->work_dir_state();
 
-    if (posix_helpers::path_exists(posix_helpers::path_join(work_dir, "updateInstalled").c_str()))
+    if (state.exists(WorkDir::UPDATE_INSTALLED))
     {
         cli_io::write_stdout("Update installation finished.\n");
         this->return_code = static_cast<int>(UPDATER_INSTALL_UPDATE_STATE::UPDATE_INSTALLATION_FINISHED);
     }
-    else if (!posix_helpers::path_exists(posix_helpers::path_join(work_dir, "update_location").c_str()))
+    else if (!state.exists(WorkDir::UPDATE_LOCATION))
     {
         this->return_code = static_cast<int>(UPDATER_INSTALL_UPDATE_STATE::NO_INSTALLATION_QUEUED);
     }
-    else if (posix_helpers::path_exists(posix_helpers::path_join(work_dir, "installUpdate").c_str()))
+    else if (state.exists(WorkDir::INSTALL_UPDATE))
     {
         cli_io::write_stdout("Update installation in progress.\n");
         this->return_code = static_cast<int>(UPDATER_INSTALL_UPDATE_STATE::UPDATE_INSTALLATION_IN_PROGRESS);
     }
     else
     {
-        const string marker = posix_helpers::path_join(work_dir, "installUpdate");
-        if (!posix_helpers::create_marker_file(marker.c_str()))
+        if (!state.create_marker(WorkDir::INSTALL_UPDATE))
         {
             cli_io::write_stdout("Could not initiate Installation...\n");
             this->return_code = static_cast<int>(UPDATER_INSTALL_UPDATE_STATE::UPDATE_INSTALLATION_FAILED);
@@ -909,16 +1826,15 @@ void cli::fs_update_cli::handle_install_update()
 
 void cli::fs_update_cli::handle_apply_update()
 {
-    const string work_dir = this->update_handler->get_work_dir().string();
-    const string installed_path = posix_helpers::path_join(work_dir, "updateInstalled");
-    const string rollback_path = posix_helpers::path_join(work_dir, "rollbackUpdate");
+    WorkDir &state = this->work_dir_state();
 
-    if (posix_helpers::path_exists(installed_path.c_str()))
+    if (state.exists(WorkDir::UPDATE_INSTALLED))
     {
-        if (!posix_helpers::path_exists(posix_helpers::path_join(work_dir, "applyUpdate").c_str()) &&
-            !posix_helpers::path_exists(posix_helpers::path_join(work_dir, "downloadUpdate").c_str()))
+        if (!state.exists(WorkDir::APPLY_UPDATE) && !state.exists(WorkDir::DOWNLOAD_UPDATE))
         {
             cli_io::write_stdout("Apply update...\n");
+            /* Before the reboot request; dispatch rewrites it if the request fails. */
+            this->write_metrics(static_cast<int>(UPDATER_APPLY_UPDATE_STATE::APPLY_SUCCESSFUL));
             if(this->reboot() != 0) {
                 const int saved = errno;
                 cli_io::write_stderr(string("Failed to reboot system: ") + strerror(saved) + "\n");
@@ -929,11 +1845,8 @@ void cli::fs_update_cli::handle_apply_update()
         }
         else
         {
-            const string apply_marker = posix_helpers::path_join(work_dir, "applyUpdate");
-            if (!posix_helpers::create_marker_file(apply_marker.c_str()))
+            if (!state.create_marker(WorkDir::APPLY_UPDATE))
             {
-                // errno is clobbered by create_marker_file's internal close();
-                // reading it here would be meaningless.
                 cli_io::write_stdout("Initiate of update apply fails...\n");
                 this->return_code = static_cast<int>(UPDATER_APPLY_UPDATE_STATE::APPLY_FAILED);
             }
@@ -944,11 +1857,14 @@ void cli::fs_update_cli::handle_apply_update()
             }
         }
     }
-    else if (posix_helpers::path_exists(rollback_path.c_str()))
+    else if (state.exists(WorkDir::ROLLBACK_UPDATE))
     {
+        this->require_backend(Backend::FSUPDATE);
+        const auto env_write = this->env_snapshot.write_scope();
         const update_definitions::UBootBootstateFlags update_reboot_state =
-            this->update_handler->get_update_reboot_state();
+            this->env_snapshot.reboot_state();
 
+        const auto env_start = std::chrono::steady_clock::now();
         if (update_reboot_state == update_definitions::UBootBootstateFlags::ROLLBACK_APP_FW_REBOOT_PENDING)
         {
             this->update_handler->update_reboot_state(
@@ -964,9 +1880,11 @@ void cli::fs_update_cli::handle_apply_update()
             this->update_handler->update_reboot_state(
                 update_definitions::UBootBootstateFlags::INCOMPLETE_APP_ROLLBACK);
         }
+        this->env_snapshot.count_write(env_start);
 
         cli_io::write_stdout("Apply rollback update...\n");
 
+        this->write_metrics(static_cast<int>(UPDATER_APPLY_UPDATE_STATE::APPLY_SUCCESSFUL));
         if(this->reboot() != 0) {
             const int saved = errno;
             cli_io::write_stderr(string("Failed to reboot system: ") + strerror(saved) + "\n");
@@ -1015,51 +1933,150 @@ void cli::fs_update_cli::parse_input(int argc, const char **argv)
 {
     this->cmd.parse(argc, argv);
 
-    this->setup_logging();
+    if (this->arg_client.isSet())
+    {
+        this->return_code = this->run_client(argc, argv);
+        return;
+    }
+
+    this->dispatch();
+}
+
+void cli::fs_update_cli::report_trace(bool summary, const string &path) const
+{
+    const Tracer &tracer = Tracer::get();
+    if (summary)
+    {
+        cli_io::write_stderr(tracer.summary());
+    }
+    if (!path.empty())
+    {
+        string error;
+        if (!tracer.write_chrome_trace(path, error))
+        {
+            cli_io::write_stderr("Trace not written: " + error + "\n");
+        }
+    }
+}
+
+void cli::fs_update_cli::dispatch()
+{
+    /* Batch and daemon requests dispatch again; their reports nest. */
+    OutputReport result(this->arg_output.getValue() == "json" && !this->arg_daemon.isSet());
+    OutputReport *const outer = this->report;
+    this->report = &result;
+
+    /* The outermost command that asks for tracing owns the tracer, except
+     * the daemon: each of its requests is traced on its own. The flags are
+     * taken now, because batch requests re-parse the arguments.
+     */
+    const bool tracing = !Tracer::get().enabled() && !this->arg_daemon.isSet() &&
+        (this->arg_trace.isSet() || this->arg_debug.isSet());
+    const bool trace_summary = this->arg_debug.isSet();
+    const string trace_path = this->arg_trace.isSet() ? this->arg_trace.getValue() : string();
+    if (tracing)
+    {
+        Tracer::get().enable();
+    }
+
+    const auto finish = [&]() {
+        if (tracing)
+        {
+            this->report_trace(trace_summary, trace_path);
+            Tracer::get().disable();
+        }
+        this->report = outer;
+        if (result.json())
+        {
+            cli_io::write_stdout(result.finish(this->return_code));
+        }
+    };
+
+    /* A throwing handler is still reported by the caller (main,
+     * execute_request), but the JSON line with code 124 is written first
+     * and this->report must not keep pointing at result.
+     */
+    try
+    {
+        this->dispatch_action();
+    }
+    catch (...)
+    {
+        this->return_code = static_cast<int>(UPDATER_FATAL::UNHANDLED_EXCEPTION);
+        finish();
+        throw;
+    }
+    finish();
+}
 
-    /* Dispatch table: maps each action flag to its handler.
-     * --debug and --update_type are modifiers, not actions.
+void cli::fs_update_cli::dispatch_action()
+{
+    /* Dispatch table: maps each action flag to its handler and the backend
+     * it depends on. Only that backend is constructed before dispatch.
+     * --debug, --update_type, --socket, --watch, --watch_interval,
+     * --timeout, --progress_file, --trace, --no_verify_cache and the
+     * resource limits (--max_write_mbps, --io_class, --cpu_affinity,
+     * --nice, --adaptive_pacing) and --output are modifiers, not actions.
      * All action flags are mutually exclusive.
      */
     struct ActionEntry {
         TCLAP::Arg* arg;
         void (fs_update_cli::*handler)();
+        Backend backend;
+        bool coded;     ///< Exit codes are enum values of return-codes.md (false: 0 means done)
+        bool metrics;   ///< Changes update state; merged into the metrics file
+        const char *span;   ///< Trace span name; a literal, as Tracer keeps the pointer
     };
 
-    const std::array<ActionEntry, 19> actions = {{
-        {&arg_update,              &fs_update_cli::handle_update_file},
-        {&arg_commit_update,       &fs_update_cli::commit_update},
-        {&arg_urs,                 &fs_update_cli::print_update_reboot_state},
-        {&arg_automatic,           &fs_update_cli::handle_automatic},
-        {&get_app_version,         &fs_update_cli::print_current_application_version},
-        {&get_fw_version,          &fs_update_cli::print_current_firmware_version},
-        {&get_version,             &fs_update_cli::handle_print_version},
-        {&notice_update_available, &fs_update_cli::handle_is_update_available},
-        {&download_update,         &fs_update_cli::handle_download_update},
-        {&download_progress,       &fs_update_cli::handle_download_progress},
-        {&install_update,          &fs_update_cli::handle_install_update},
-        {&apply_update,            &fs_update_cli::handle_apply_update},
-        {&arg_rollback_update,     &fs_update_cli::rollback_update},
-        {&arg_switch_fw_slot,      &fs_update_cli::switch_firmware_slot},
-        {&arg_switch_app_slot,     &fs_update_cli::switch_application_slot},
-        {&set_app_state_bad,       &fs_update_cli::handle_set_app_state_bad},
-        {&is_app_state_bad,        &fs_update_cli::handle_is_app_state_bad},
-        {&set_fw_state_bad,        &fs_update_cli::handle_set_fw_state_bad},
-        {&is_fw_state_bad,         &fs_update_cli::handle_is_fw_state_bad},
+    const std::array<ActionEntry, 24> actions = {{
+        {&arg_update,              &fs_update_cli::handle_update_file,                Backend::FSUPDATE,  true,  true,  "update_file"},
+        {&arg_check_integrity,     &fs_update_cli::handle_check_integrity,            Backend::NONE,      true,  true,  "check_integrity"},
+        {&arg_commit_update,       &fs_update_cli::commit_update,                     Backend::FSUPDATE,  true,  true,  "commit_update"},
+        {&arg_urs,                 &fs_update_cli::print_update_reboot_state,         Backend::UBOOT_ENV, true,  false, "update_reboot_state"},
+        {&arg_status,              &fs_update_cli::handle_status,                     Backend::WORK_DIR,  true,  false, "status"},
+        /* Builds FSUPDATE itself once the update file prefetch runs. */
+        {&arg_automatic,           &fs_update_cli::handle_automatic,                  Backend::NONE,      true,  true,  "automatic"},
+        {&get_app_version,         &fs_update_cli::print_current_application_version, Backend::UBOOT_ENV, false, false, "application_version"},
+        {&get_fw_version,          &fs_update_cli::print_current_firmware_version,    Backend::UBOOT_ENV, false, false, "firmware_version"},
+        {&get_version,             &fs_update_cli::handle_print_version,              Backend::NONE,      false, false, "version"},
+        {&notice_update_available, &fs_update_cli::handle_is_update_available,        Backend::WORK_DIR,  true,  false, "is_update_available"},
+        {&download_update,         &fs_update_cli::handle_download_update,            Backend::WORK_DIR,  true,  false, "download_update"},
+        {&download_progress,       &fs_update_cli::handle_download_progress,          Backend::WORK_DIR,  true,  false, "download_progress"},
+        {&install_update,          &fs_update_cli::handle_install_update,             Backend::WORK_DIR,  true,  false, "install_update"},
+        {&arg_wait_for,            &fs_update_cli::handle_wait_for,                   Backend::WORK_DIR,  true,  false, "wait_for"},
+        /* Escalates to FSUPDATE itself when a rollback has to be applied. */
+        {&apply_update,            &fs_update_cli::handle_apply_update,               Backend::WORK_DIR,  true,  true,  "apply_update"},
+        {&arg_rollback_update,     &fs_update_cli::rollback_update,                   Backend::FSUPDATE,  true,  true,  "rollback_update"},
+        {&arg_switch_fw_slot,      &fs_update_cli::switch_firmware_slot,              Backend::FSUPDATE,  true,  true,  "switch_fw_slot"},
+        {&arg_switch_app_slot,     &fs_update_cli::switch_application_slot,           Backend::FSUPDATE,  true,  true,  "switch_app_slot"},
+        {&set_app_state_bad,       &fs_update_cli::handle_set_app_state_bad,          Backend::FSUPDATE,  true,  false, "set_app_state_bad"},
+        {&is_app_state_bad,        &fs_update_cli::handle_is_app_state_bad,           Backend::UBOOT_ENV, true,  false, "is_app_state_bad"},
+        {&set_fw_state_bad,        &fs_update_cli::handle_set_fw_state_bad,           Backend::FSUPDATE,  true,  false, "set_fw_state_bad"},
+        {&is_fw_state_bad,         &fs_update_cli::handle_is_fw_state_bad,            Backend::UBOOT_ENV, true,  false, "is_fw_state_bad"},
+        {&arg_daemon,              &fs_update_cli::run_daemon,                        Backend::FSUPDATE,  false, false, "daemon"},
+        /* Each batched command constructs its own backend on first use. */
+        {&arg_batch,               &fs_update_cli::run_batch,                         Backend::NONE,      false, false, "batch"},
     }};
 
-    void (fs_update_cli::*matched_handler)() = nullptr;
+    const ActionEntry *matched = nullptr;
     int action_count = 0;
 
     for (const auto& entry : actions)
     {
         if (entry.arg->isSet())
         {
-            matched_handler = entry.handler;
+            matched = &entry;
             ++action_count;
         }
     }
 
+    if (this->arg_output.getValue() != "json" && this->arg_output.getValue() != "text")
+    {
+        cli_io::write_stderr("--output must be json or text\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::INCOMPATIBLE_ARG_COMBO);
+        return;
+    }
+
     /* --update_type is only valid with --update_file */
     if (this->arg_update_type.isSet() && !this->arg_update.isSet())
     {
@@ -1068,6 +2085,52 @@ void cli::fs_update_cli::parse_input(int argc, const char **argv)
         return;
     }
 
+    /* --watch and --watch_interval are only valid with --download_progress */
+    if ((this->arg_watch.isSet() || this->arg_watch_interval.isSet()) && !this->download_progress.isSet())
+    {
+        cli_io::write_stderr("--watch can only be used with --download_progress\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::MODIFIER_WITHOUT_ACTION);
+        return;
+    }
+
+    if (this->arg_no_verify_cache.isSet() && !this->arg_check_integrity.isSet())
+    {
+        cli_io::write_stderr("--no_verify_cache can only be used with --check_integrity\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::MODIFIER_WITHOUT_ACTION);
+        return;
+    }
+
+    if (this->arg_progress_file.isSet() && !this->arg_update.isSet() && !this->arg_automatic.isSet())
+    {
+        cli_io::write_stderr("--progress_file can only be used with --update_file or --automatic\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::MODIFIER_WITHOUT_ACTION);
+        return;
+    }
+
+    if (this->arg_timeout.isSet() && !this->arg_wait_for.isSet())
+    {
+        cli_io::write_stderr("--timeout can only be used with --wait_for\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::MODIFIER_WITHOUT_ACTION);
+        return;
+    }
+
+    const bool resource_limits = this->arg_max_write_mbps.isSet() || this->arg_io_class.isSet() ||
+        this->arg_cpu_affinity.isSet() || this->arg_nice.isSet() || this->arg_adaptive_pacing.isSet();
+    if (resource_limits && !this->arg_update.isSet() && !this->arg_automatic.isSet())
+    {
+        cli_io::write_stderr("--max_write_mbps, --io_class, --cpu_affinity, --nice and --adaptive_pacing "
+            "can only be used with --update_file or --automatic\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::MODIFIER_WITHOUT_ACTION);
+        return;
+    }
+
+    if (this->arg_adaptive_pacing.isSet() && !this->arg_max_write_mbps.isSet())
+    {
+        cli_io::write_stderr("--adaptive_pacing can only be used with --max_write_mbps\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::MODIFIER_WITHOUT_ACTION);
+        return;
+    }
+
     if (action_count == 0)
     {
         this->handle_print_version();
@@ -1075,7 +2138,38 @@ void cli::fs_update_cli::parse_input(int argc, const char **argv)
     }
     else if (action_count == 1)
     {
-        (this->*matched_handler)();
+        const ResourceScope resource_scope(resource_limits);
+        if (resource_limits && !this->apply_resource_limits())
+        {
+            return;
+        }
+        this->report->set_command(matched->arg->getName());
+        this->report->set_enum_codes(matched->coded);
+
+        std::unique_ptr<Metrics> run_metrics;
+        if (matched->metrics && Metrics::enabled())
+        {
+            run_metrics = std::make_unique<Metrics>(matched->arg->getName());
+            this->metrics_env_start = this->env_snapshot.latency();
+        }
+        Metrics *const outer_metrics = this->metrics;
+        this->metrics = run_metrics.get();
+
+        try
+        {
+            FSCLI_TRACE_SPAN(matched->span);
+            this->require_backend(matched->backend);
+            (this->*(matched->handler))();
+        }
+        catch (...)
+        {
+            this->write_metrics(static_cast<int>(UPDATER_FATAL::UNHANDLED_EXCEPTION));
+            this->metrics = outer_metrics;
+            throw;
+        }
+
+        this->write_metrics(this->return_code);
+        this->metrics = outer_metrics;
     }
     else
     {
@@ -1084,6 +2178,27 @@ void cli::fs_update_cli::parse_input(int argc, const char **argv)
     }
 }
 
+void cli::fs_update_cli::write_metrics(int code)
+{
+    if (this->metrics == nullptr)
+    {
+        return;
+    }
+
+    const EnvSnapshot::Latency &env = this->env_snapshot.latency();
+    this->metrics->set("fs_updater_env_reads", static_cast<double>(env.reads - this->metrics_env_start.reads));
+    this->metrics->set("fs_updater_env_read_seconds",
+        static_cast<double>(env.read_ns - this->metrics_env_start.read_ns) / 1e9);
+    this->metrics->set("fs_updater_env_writes", static_cast<double>(env.writes - this->metrics_env_start.writes));
+    this->metrics->set("fs_updater_env_write_seconds",
+        static_cast<double>(env.write_ns - this->metrics_env_start.write_ns) / 1e9);
+
+    if (!this->metrics->write(code))
+    {
+        cli_io::write_stderr(string("Metrics not written to ") + FUS_CLI_METRICS_DIR + ": " + std::strerror(errno) + "\n");
+    }
+}
+
 // ---------------------------------------------------------------------------
 // Utilities
 // ---------------------------------------------------------------------------
@@ -1099,7 +2214,15 @@ int cli::fs_update_cli::reboot() const
      * SIGINT → ctrl-alt-del.target → reboot.target → graceful unit stop + reboot.
      * Uses kill(2) directly: POSIX syscall, no fork/exec/system (MISRA-compliant).
      * ::sync() flushes dirty buffers before systemd begins stopping services.
+     * Queued serial log lines are written first so the last messages reach the console.
      */
-    ::sync();
+    if (this->serial_sink)
+    {
+        this->serial_sink->flush();
+    }
+    {
+        FSCLI_TRACE_SPAN("sync");
+        ::sync();
+    }
     return ::kill(1, SIGINT);
 }
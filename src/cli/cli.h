@@ -3,12 +3,20 @@
 #include <fs_update_framework/handle_update/fsupdate.h>
 
 #include <fs_update_framework/logger/LoggerHandler.h>
-#include <fs_update_framework/logger/LoggerSinkStdout.h>
 #include <fs_update_framework/logger/LoggerSinkEmpty.h>
+#include <fs_update_framework/uboot_interface/UBoot.h>
 
 #include "SynchronizedSerial.h"
+#include "fs_updater_error.h"
+#include "EnvSnapshot.h"
+#include "WorkDir.h"
+#include "ProgressMonitor.h"
+#include "Prefetch.h"
+#include "Throttle.h"
 #include "../logger/LoggerSinkSerial.h"
+#include "../logger/LoggerSinkConsole.h"
 
+#include <chrono>
 #include <string>
 #include <stdexcept>
 #include <climits>
@@ -23,6 +31,23 @@
  */
 namespace cli
 {
+	/**
+	 * Backend an action depends on. The CLI constructs only the level an
+	 * action declares, so cheap queries never pay for fs::FSUpdate.
+	 */
+	enum class Backend : uint8_t
+	{
+		NONE,		///< Nothing beyond the parsed arguments
+		WORK_DIR,	///< Work directory path (signal files)
+		UBOOT_ENV,	///< U-Boot environment reads, served by the EnvSnapshot
+				///< (backend constructed only on a snapshot miss)
+		FSUPDATE	///< Logger and full fs::FSUpdate instance
+	};
+
+	class BlockWriter;
+	class Metrics;
+	class OutputReport;
+
 	class fs_update_cli
 	{
         private:
@@ -48,11 +73,47 @@ namespace cli
 		TCLAP::ValueArg<char> is_app_state_bad;
 		TCLAP::ValueArg<char> set_fw_state_bad;
 		TCLAP::ValueArg<char> is_fw_state_bad;
+		TCLAP::SwitchArg arg_daemon;
+		TCLAP::SwitchArg arg_client;
+		TCLAP::ValueArg<std::string> arg_socket;
+		TCLAP::ValueArg<std::string> arg_batch;
+		TCLAP::SwitchArg arg_watch;
+		TCLAP::ValueArg<unsigned int> arg_watch_interval;
+		TCLAP::ValueArg<std::string> arg_wait_for;
+		TCLAP::ValueArg<unsigned int> arg_timeout;
+		TCLAP::ValueArg<std::string> arg_check_integrity;
+		TCLAP::SwitchArg arg_no_verify_cache;
+		TCLAP::ValueArg<std::string> arg_progress_file;
+		TCLAP::ValueArg<std::string> arg_trace;
+		TCLAP::ValueArg<unsigned int> arg_max_write_mbps;
+		TCLAP::ValueArg<std::string> arg_io_class;
+		TCLAP::ValueArg<std::string> arg_cpu_affinity;
+		TCLAP::ValueArg<int> arg_nice;
+		TCLAP::SwitchArg arg_adaptive_pacing;
+		TCLAP::SwitchArg arg_status;
+		TCLAP::ValueArg<std::string> arg_output;
 
 		std::unique_ptr<fs::FSUpdate> update_handler;
+		std::unique_ptr<UBoot::UBoot> uboot_handler;
+		std::string work_dir_path;
+		WorkDir work_dir_index;
 		std::shared_ptr<SynchronizedSerial> serial_cout;
+		std::shared_ptr<logger::LoggerSinkSerial> serial_sink;
 		std::shared_ptr<logger::LoggerSinkBase> logger_sink;
 		std::shared_ptr<logger::LoggerHandler> logger_handler;
+		logger::logLevel log_level{logger::logLevel::WARNING};
+		EnvSnapshot env_snapshot;
+		std::unique_ptr<ProgressMonitor> progress;
+		std::unique_ptr<Prefetch> prefetch;
+		std::unique_ptr<Throttle> throttle;
+		int progress_fd{-1};
+		/* Set while --batch runs its requests; they share one log sink */
+		bool serving_requests{false};
+		/* Result of the running command; set during dispatch() */
+		OutputReport *report{nullptr};
+		/* Metrics of the running command; nullptr unless it changes state and FUS_CLI_METRICS_DIR is set */
+		Metrics *metrics{nullptr};
+		EnvSnapshot::Latency metrics_env_start;
 
 		int return_code;
 
@@ -61,12 +122,104 @@ namespace cli
 		 */
 		void setup_logging();
 
+		/**
+		 * Construct the backend required by an action, if not done yet.
+		 * With --debug the construction time is reported on stderr.
+		 * @param level Backend the action depends on.
+		 */
+		void require_backend(Backend level);
+
+		/**
+		 * Work directory of the update framework.
+		 * Taken from fs::FSUpdate when constructed, else from the build configuration.
+		 * @return Path of the work directory.
+		 */
+		const std::string &work_dir();
+
+		/**
+		 * Snapshot of the work directory, taken on first use.
+		 * @return Work directory index.
+		 */
+		WorkDir &work_dir_state();
+
+		/**
+		 * U-Boot environment handler, constructed on first use.
+		 * @return Environment handler.
+		 */
+		UBoot::UBoot &uboot_env();
+
 		/**
 		 * Internal function to run update and handle errors as return_value:
 		 * @param update_file Path to update package (fully resolved)
 		 */
 		void update_image_state(const std::string &update_file);
 
+		/**
+		 * Copy an update from a pipe to a spool file in FUS_CLI_SPOOL_DIR
+		 * and install it from there. A gzip stream is decompressed on the
+		 * way (see ParallelInflate). The spool file is always removed.
+		 * @param source Readable descriptor (stdin, an opened FIFO or a gzip file).
+		 * @param name Source name used in messages.
+		 */
+		void update_from_stream(int source, const std::string &name);
+
+		/**
+		 * Rebuild an update from a delta against the active application
+		 * slot (FUS_CLI_APP_SLOT_PATH) into a spool file and install it.
+		 * @param delta Delta file, see DeltaPatch.
+		 */
+		void update_from_delta(const std::string &delta);
+
+		/**
+		 * @return File name suffix of a spooled update for --update_type.
+		 */
+		std::string spool_suffix();
+
+		/**
+		 * Record the writes of a finished spool file: the spool metric and,
+		 * with --debug, written and sparse bytes on stderr.
+		 * @param writer Finished writer.
+		 */
+		void spool_finished(const BlockWriter &writer);
+
+		/**
+		 * Start install progress reporting, if not running yet. Lines go to
+		 * stdout (serial console with --automatic) and to --progress_file.
+		 * @return Running monitor; phases are added by the caller.
+		 */
+		ProgressMonitor &begin_progress();
+
+		/**
+		 * Stop install progress reporting and close --progress_file.
+		 * @param result Phase of the final line: "done" or "failed".
+		 */
+		void end_progress(const char *result);
+
+		/**
+		 * Apply --io_class, --nice and --cpu_affinity to this thread (and
+		 * so to every thread started later) and set up --max_write_mbps.
+		 * @return false on an invalid value; return_code is set.
+		 */
+		bool apply_resource_limits();
+
+		/**
+		 * Print the throughput of an install against --max_write_mbps.
+		 * @param update_file Installed file.
+		 * @param elapsed Duration of update_image().
+		 */
+		void report_throughput(const std::string &update_file, std::chrono::milliseconds elapsed);
+
+		/**
+		 * Recreate the work directory through fs::FSUpdate.
+		 */
+		void create_work_dir();
+
+		/**
+		 * Prepare a rollback of one component to its other slot.
+		 * @param firmware true for the firmware, false for the application.
+		 */
+		void rollback_slot(bool firmware);
+
 		/**
 		 * Create rollback marker file in work directory.
 		 * @return true on success, false on failure
@@ -78,6 +231,13 @@ namespace cli
 		 */
 		void print_update_reboot_state();
 
+		/**
+		 * Map the U-Boot update state to the --update_reboot_state result.
+		 * @param message Receives the state description.
+		 * @return Exit code of --update_reboot_state.
+		 */
+		UPDATER_UPDATE_REBOOT_STATE resolve_reboot_state(const char *&message);
+
 		/**
 		 * Print current installed firmware version.
 		 */
@@ -155,6 +315,98 @@ namespace cli
 		void handle_is_app_state_bad();
 		void handle_set_fw_state_bad();
 		void handle_is_fw_state_bad();
+		void handle_status();
+
+		/**
+		 * Download state derived from the work directory signal files.
+		 */
+		struct DownloadStatus
+		{
+			uint64_t update_size{0};
+			uint64_t loaded{0};
+			std::string target;
+		};
+
+		/**
+		 * Evaluate the download signal files and the size of the download target.
+		 * @param status Receives expected size, loaded bytes and target path.
+		 * @param report Print the one-shot --download_progress messages.
+		 * @return UPDATER_DOWNLOAD_PROGRESS_STATE code.
+		 */
+		int read_download_progress(DownloadStatus &status, bool report);
+
+		/**
+		 * --download_progress --watch: print a progress line whenever the work
+		 * directory or the download target changes, until the download ends.
+		 */
+		void watch_download_progress();
+
+		/**
+		 * --wait_for: block until a signal file exists in the work directory,
+		 * the --timeout expires or the work directory is removed.
+		 */
+		void handle_wait_for();
+
+		/**
+		 * --check_integrity: stream a .fs bundle once and check the SHA-256 of
+		 * every component against fsupdate.json without installing anything.
+		 * Signatures are left to fs-updater-lib.
+		 */
+		void handle_check_integrity();
+
+		/**
+		 * Run the single action selected by the parsed arguments and, with
+		 * --output json, print its result as one JSON line.
+		 */
+		void dispatch();
+
+		/**
+		 * Validate the modifiers and run the selected action.
+		 */
+		void dispatch_action();
+
+		/**
+		 * Merge the running command into the metrics file, if it records metrics.
+		 * @param code Exit code to report.
+		 */
+		void write_metrics(int code);
+
+		/**
+		 * Parse and run one request against the already constructed backend.
+		 * Used by the daemon and batch mode; never throws.
+		 * @param args Action arguments without program name.
+		 * @return Return code of the request.
+		 */
+		int execute_request(const std::vector<std::string> &args);
+
+		/**
+		 * Serve requests on the Unix socket until SIGTERM or SIGINT.
+		 * Requests are handled one at a time, so all writes are serialized.
+		 */
+		void run_daemon();
+
+		/**
+		 * Handle one connected client of the daemon.
+		 * @param client Connected socket.
+		 * @param saved_out Daemon's own stdout, restored after the request.
+		 * @param saved_err Daemon's own stderr, restored after the request.
+		 */
+		void serve_client(int client, int saved_out, int saved_err);
+
+		/**
+		 * Run every command read from the --batch file (or stdin for "-")
+		 * against one shared backend and print one result record per command.
+		 */
+		void run_batch();
+
+		/**
+		 * Forward the action arguments to a running daemon.
+		 * Output is written by the daemon directly to this process' stdout and stderr.
+		 * @param argc Number of arguments.
+		 * @param argv List of all commands
+		 * @return Return code reported by the daemon.
+		 */
+		int run_client(int argc, const char ** argv);
 
 		/**
 		 * Parse input and run as described in commands.
@@ -163,6 +415,13 @@ namespace cli
 		 * @throw ErrorNotSystemVariable
 		 */
 		void parse_input(int argc, const char ** argv);
+
+		/**
+		 * Print the span summary and write the trace file.
+		 * @param summary Print the summary on stderr (--debug).
+		 * @param path Trace file (--trace), empty for none.
+		 */
+		void report_trace(bool summary, const std::string &path) const;
 		int reboot() const;
 
         public:
@@ -0,0 +1,101 @@
+#include "cli.h"
+#include "fs_updater_error.h"
+#include "posix_helpers.h"
+#include "cli_io.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace
+{
+    /* Split one batch line at blanks; no quoting, paths must not contain blanks. */
+    void split_args(const string &line, std::vector<string> &args)
+    {
+        args.clear();
+        string::size_type pos = 0;
+        while (pos < line.size())
+        {
+            pos = line.find_first_not_of(" \t\r", pos);
+            if (pos == string::npos)
+            {
+                break;
+            }
+            const string::size_type end = line.find_first_of(" \t\r", pos);
+            args.emplace_back(line, pos, (end == string::npos) ? string::npos : end - pos);
+            pos = end;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Batch execution
+// ---------------------------------------------------------------------------
+
+void cli::fs_update_cli::run_batch()
+{
+    const string source = this->arg_batch.getValue();
+    string input;
+    bool read_ok = false;
+
+    if (source == "-")
+    {
+        read_ok = posix_helpers::read_fd(STDIN_FILENO, input);
+    }
+    else
+    {
+        const int fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            read_ok = posix_helpers::read_fd(fd, input);
+            ::close(fd);
+        }
+    }
+
+    if (!read_ok)
+    {
+        cli_io::write_stderr("Batch file: " + source + " could not be read.\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::BATCH_FILE_NOT_FOUND);
+        return;
+    }
+
+    /* A malformed line must not abort the remaining commands. */
+    this->cmd.setExceptionHandling(false);
+
+    this->serving_requests = true;
+    std::vector<string> args;
+    unsigned int index = 0;
+    string::size_type line_start = 0;
+
+    while (line_start < input.size())
+    {
+        string::size_type line_end = input.find('\n', line_start);
+        if (line_end == string::npos)
+        {
+            line_end = input.size();
+        }
+        const string line = input.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+
+        split_args(line, args);
+        if (args.empty() || args.front().front() == '#')
+        {
+            continue;
+        }
+
+        ++index;
+        const int result = this->execute_request(args);
+
+        string record = "result " + std::to_string(index) + " " + std::to_string(result);
+        for (const auto &arg : args)
+        {
+            record += " " + arg;
+        }
+        record += "\n";
+        cli_io::write_stdout(record);
+    }
+    this->serving_requests = false;
+
+    this->return_code = 0;
+}
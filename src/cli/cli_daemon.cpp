@@ -0,0 +1,276 @@
+#include "cli.h"
+#include "fs_updater_error.h"
+#include "posix_helpers.h"
+#include "daemon_protocol.h"
+#include "cli_io.h"
+#include "OutputReport.h"
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <csignal>
+
+using std::string;
+
+namespace
+{
+    volatile std::sig_atomic_t daemon_stop = 0;
+
+    /* A request is a few hundred bytes; a client still sending after this
+     * has stalled and would block every later request.
+     */
+    constexpr std::chrono::milliseconds REQUEST_TIMEOUT{5000};
+
+    void handle_stop_signal(int)
+    {
+        daemon_stop = 1;
+    }
+
+    /* Only root and the daemon's own user may drive the update backend. */
+    bool peer_allowed(int client)
+    {
+        struct ucred cred{};
+        socklen_t len = sizeof(cred);
+        if (::getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+        {
+            return false;
+        }
+        return (cred.uid == 0) || (cred.uid == ::geteuid());
+    }
+
+    /* --output json of a request that may not have parsed. */
+    bool wants_json(const std::vector<string> &args)
+    {
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            if (args[i] == "--output=json" || (args[i] == "--output" && i + 1U < args.size() && args[i + 1U] == "json"))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Request execution (daemon and batch)
+// ---------------------------------------------------------------------------
+
+int cli::fs_update_cli::execute_request(const std::vector<string> &args)
+{
+    std::vector<string> request_argv;
+    request_argv.reserve(args.size() + 1);
+    request_argv.emplace_back("fs-updater");
+    request_argv.insert(request_argv.end(), args.begin(), args.end());
+
+    this->cmd.reset();
+    this->return_code = 0;
+    /* The environment and the work directory may have been changed by another
+     * process since the last request.
+     */
+    this->env_snapshot.clear();
+    this->work_dir_index.close();
+    this->throttle.reset();
+
+    /* dispatch() writes the JSON line itself, also when a handler throws. */
+    bool dispatched = false;
+    try
+    {
+        this->cmd.parse(request_argv);
+
+        /* --automatic reads the caller's environment and the serial console;
+         * --watch and --wait_for would block every other request.
+         */
+        if (this->arg_daemon.isSet() || this->arg_client.isSet() || this->arg_batch.isSet() ||
+            this->arg_automatic.isSet() || this->arg_watch.isSet() || this->arg_wait_for.isSet())
+        {
+            cli_io::write_stderr("--daemon, --client, --batch, --automatic, --watch and --wait_for cannot be nested\n");
+            this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::INCOMPATIBLE_ARG_COMBO);
+        }
+        else
+        {
+            dispatched = true;
+            this->dispatch();
+        }
+    }
+    catch (const TCLAP::ArgException &e)
+    {
+        /* Same exit status TCLAP uses for parse errors in a standalone run */
+        cli_io::write_stderr("PARSE ERROR: " + e.argId() + "\n             " + e.error() + "\n");
+        this->return_code = 1;
+    }
+    catch (const std::exception &e)
+    {
+        cli_io::write_stderr(string("Unhandled std::exception: ") + e.what() + "\n");
+        this->return_code = static_cast<int>(UPDATER_FATAL::UNHANDLED_EXCEPTION);
+    }
+
+    /* Parse errors and rejected nesting still give one JSON line. */
+    if (!dispatched && wants_json(args))
+    {
+        OutputReport result(true);
+        cli_io::write_stdout(result.finish(this->return_code));
+    }
+    return this->return_code;
+}
+
+// ---------------------------------------------------------------------------
+// Daemon
+// ---------------------------------------------------------------------------
+
+void cli::fs_update_cli::serve_client(int client, int saved_out, int saved_err)
+{
+    std::vector<string> args;
+    int out_fd = -1;
+    int err_fd = -1;
+
+    if (!peer_allowed(client))
+    {
+        return;
+    }
+    if (!daemon_protocol::receive_request(client, args, out_fd, err_fd, REQUEST_TIMEOUT))
+    {
+        if (errno == ETIMEDOUT)
+        {
+            cli_io::write_stderr("Daemon: client request timed out, connection dropped\n");
+        }
+    }
+    else
+    {
+        /* Handlers write to fd 1/2; point them at the client's descriptors. */
+        static_cast<void>(::dup2(out_fd, STDOUT_FILENO));
+        static_cast<void>(::dup2(err_fd, STDERR_FILENO));
+
+        const int32_t result = this->execute_request(args);
+
+        static_cast<void>(::dup2(saved_out, STDOUT_FILENO));
+        static_cast<void>(::dup2(saved_err, STDERR_FILENO));
+
+        static_cast<void>(daemon_protocol::send_all(client, &result, sizeof(result)));
+    }
+
+    if (out_fd >= 0) { ::close(out_fd); }
+    if (err_fd >= 0) { ::close(err_fd); }
+}
+
+void cli::fs_update_cli::run_daemon()
+{
+    const string socket_path = this->arg_socket.getValue();
+
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path))
+    {
+        cli_io::write_stderr("Socket path too long: " + socket_path + "\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::DAEMON_SOCKET_FAILED);
+        return;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    const int listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        cli_io::write_stderr(string("Failed to create socket: ") + strerror(errno) + "\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::DAEMON_SOCKET_FAILED);
+        return;
+    }
+
+    /* Remove a stale socket of a previous daemon; restrict access to the owner. */
+    static_cast<void>(posix_helpers::remove_file(socket_path.c_str()));
+    const mode_t old_mask = ::umask(0177);
+    const int bound = ::bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    ::umask(old_mask);
+
+    if (bound != 0 || ::listen(listen_fd, 8) != 0)
+    {
+        cli_io::write_stderr("Failed to listen on " + socket_path + ": " + strerror(errno) + "\n");
+        ::close(listen_fd);
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::DAEMON_SOCKET_FAILED);
+        return;
+    }
+
+    /* No SA_RESTART: accept() must return on SIGTERM/SIGINT. */
+    struct sigaction stop_action{};
+    stop_action.sa_handler = handle_stop_signal;
+    sigemptyset(&stop_action.sa_mask);
+    ::sigaction(SIGTERM, &stop_action, nullptr);
+    ::sigaction(SIGINT, &stop_action, nullptr);
+    /* A client closing its stdout early must not terminate the daemon. */
+    std::signal(SIGPIPE, SIG_IGN);
+
+    /* Parse errors of a request must not exit the daemon. */
+    this->cmd.setExceptionHandling(false);
+
+    const int saved_out = ::fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    const int saved_err = ::fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    cli_io::write_stdout("Daemon listening on " + socket_path + "\n");
+
+    while (daemon_stop == 0)
+    {
+        const int client = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            cli_io::write_stderr(string("Daemon accept failed: ") + strerror(errno) + "\n");
+            break;
+        }
+        this->serve_client(client, saved_out, saved_err);
+        ::close(client);
+    }
+
+    ::close(listen_fd);
+    static_cast<void>(posix_helpers::remove_file(socket_path.c_str()));
+    if (saved_out >= 0) { ::close(saved_out); }
+    if (saved_err >= 0) { ::close(saved_err); }
+
+    this->return_code = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Client
+// ---------------------------------------------------------------------------
+
+int cli::fs_update_cli::run_client(int argc, const char **argv)
+{
+    std::vector<string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        const string arg(argv[i]);
+        if (arg == "--client")
+        {
+            continue;
+        }
+        if (arg == "--socket")
+        {
+            ++i;
+            continue;
+        }
+        args.push_back(arg);
+    }
+
+    const string socket_path = this->arg_socket.getValue();
+    int sock = -1;
+    if (!daemon_protocol::connect_socket(socket_path.c_str(), sock))
+    {
+        cli_io::write_stderr("Cannot connect to daemon at " + socket_path + ": " + strerror(errno) + "\n");
+        return static_cast<int>(UPDATER_SYSTEM::DAEMON_UNAVAILABLE);
+    }
+
+    int32_t result = 0;
+    const bool ok = daemon_protocol::send_request(sock, args, STDOUT_FILENO, STDERR_FILENO) &&
+                    daemon_protocol::recv_all(sock, &result, sizeof(result));
+    ::close(sock);
+
+    if (!ok)
+    {
+        cli_io::write_stderr("Daemon closed the connection without a result\n");
+        return static_cast<int>(UPDATER_SYSTEM::DAEMON_UNAVAILABLE);
+    }
+    return static_cast<int>(result);
+}
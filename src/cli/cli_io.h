@@ -1,12 +1,29 @@
 #pragma once
 
+#include <string>
 #include <string_view>
 #include <unistd.h>
 
 namespace cli_io {
 
+/**
+ * Buffer that receives stdout text instead of the descriptor, or nullptr.
+ * Set while a command runs with --output json (see OutputReport).
+ */
+inline std::string *&stdout_capture() noexcept
+{
+    static std::string *capture = nullptr;
+    return capture;
+}
+
 inline void write_stdout(std::string_view msg) noexcept
 {
+    std::string *capture = stdout_capture();
+    if (capture != nullptr)
+    {
+        capture->append(msg.data(), msg.size());
+        return;
+    }
     ssize_t ret = ::write(STDOUT_FILENO, msg.data(), msg.size());
     (void)ret;
 }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <fs_update_framework/logger/LoggerHandler.h>
+#include <fs_update_framework/logger/LoggerEntry.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "config.h"
+
+/**
+ * Log entries emitted by the CLI itself.
+ * Levels below FUS_CLI_MIN_LOG_LEVEL are removed at compile time: the message
+ * expression is never evaluated and no LogEntry is built. Enabled levels are
+ * still filtered at runtime against the sink level chosen by --debug.
+ */
+namespace cli_log {
+
+constexpr int level_rank(logger::logLevel level) noexcept
+{
+    switch (level)
+    {
+        case logger::logLevel::DEBUG:
+            return 0;
+        case logger::logLevel::WARNING:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+constexpr bool compiled_in(logger::logLevel level) noexcept
+{
+    return level_rank(level) >= FUS_CLI_MIN_LOG_LEVEL;
+}
+
+template <logger::logLevel Level, typename MessageFn>
+inline void emit(const std::shared_ptr<logger::LoggerHandler> &handler, logger::logLevel sink_level,
+                 const char *domain, MessageFn &&message)
+{
+    if constexpr (compiled_in(Level))
+    {
+        if (handler && level_rank(Level) >= level_rank(sink_level))
+        {
+            handler->setLogEntry(std::make_shared<logger::LogEntry>(domain, std::forward<MessageFn>(message)(), Level));
+        }
+    }
+    else
+    {
+        static_cast<void>(handler);
+        static_cast<void>(sink_level);
+        static_cast<void>(domain);
+        static_cast<void>(message);
+    }
+}
+
+} // namespace cli_log
+
+/* For fs_update_cli members; msg is only evaluated if the entry is emitted. */
+#define FSCLI_LOG(level, msg) \
+    cli_log::emit<logger::logLevel::level>(this->logger_handler, this->log_level, FSCLI_DOMAIN, \
+                                           [&]() { return std::string(msg); })
+
+#define FSCLI_LOG_DEBUG(msg) FSCLI_LOG(DEBUG, msg)
+#define FSCLI_LOG_WARNING(msg) FSCLI_LOG(WARNING, msg)
+#define FSCLI_LOG_ERROR(msg) FSCLI_LOG(ERROR, msg)
@@ -0,0 +1,157 @@
+#include "cli.h"
+#include "fs_updater_error.h"
+#include "posix_helpers.h"
+#include "BundleVerifier.h"
+#include "VerifyCache.h"
+#include "Metrics.h"
+#include "OutputReport.h"
+#include "cli_io.h"
+
+#include <cstdio>
+
+using std::string;
+
+namespace
+{
+    /* "12.3 MiB/s"; one decimal is enough to compare media. */
+    string throughput(uint64_t bytes, uint64_t nanoseconds)
+    {
+        char text[32];
+        const double seconds = static_cast<double>(nanoseconds) / 1e9;
+        const double mib = static_cast<double>(bytes) / (1024.0 * 1024.0);
+        if (seconds <= 0.0)
+        {
+            return "-";
+        }
+        static_cast<void>(std::snprintf(text, sizeof(text), "%.1f MiB/s", mib / seconds));
+        return text;
+    }
+
+    string seconds(uint64_t nanoseconds)
+    {
+        char text[32];
+        static_cast<void>(std::snprintf(text, sizeof(text), "%.2f s", static_cast<double>(nanoseconds) / 1e9));
+        return text;
+    }
+
+    /* "  app_update.artifact (application 20260101)"; the status follows. */
+    string component_line(const cli::BundleVerifier::Component &component)
+    {
+        string line = "  " + component.file;
+        if (!component.handler.empty())
+        {
+            line += " (" + component.handler;
+            if (!component.version.empty())
+            {
+                line += " " + component.version;
+            }
+            line += ")";
+        }
+        return line;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// --check_integrity
+// ---------------------------------------------------------------------------
+
+void cli::fs_update_cli::handle_check_integrity()
+{
+    const string bundle = this->arg_check_integrity.getValue();
+
+    if (!posix_helpers::path_exists(bundle.c_str()))
+    {
+        cli_io::write_stderr("Update file: " + bundle + " does not exist.\n");
+        this->return_code = static_cast<int>(UPDATER_CLI_VALIDATION::UPDATE_FILE_NOT_FOUND);
+        return;
+    }
+
+    /* The identity is taken before the read; a file changed meanwhile is not cached. */
+    VerifyCache::Key key;
+    const bool identified = VerifyCache::identify(bundle, key);
+    std::vector<BundleVerifier::Component> cached;
+    if (identified && !this->arg_no_verify_cache.isSet() && VerifyCache::lookup(key, cached))
+    {
+        string report;
+        for (const auto &component : cached)
+        {
+            report += component_line(component) + ": ok, " + std::to_string(component.size) + " bytes, cached\n";
+        }
+        this->report->set("cached", true);
+        this->report->set("components", static_cast<uint64_t>(cached.size()));
+        cli_io::write_stdout(report + "Bundle verified (cached result, file unchanged).\n");
+        this->return_code = static_cast<int>(UPDATER_VERIFY_STATE::VERIFY_SUCCESSFUL);
+        return;
+    }
+
+    BundleVerifier verifier(bundle);
+    const BundleVerifier::Result result = verifier.run();
+
+    VerifyCache::Key after;
+    if (result == BundleVerifier::Result::VERIFIED && identified &&
+        VerifyCache::identify(bundle, after) && after == key)
+    {
+        VerifyCache::store(key, verifier.components());
+    }
+    else
+    {
+        VerifyCache::invalidate();
+    }
+
+    switch (result)
+    {
+        case BundleVerifier::Result::READ_FAILED:
+            cli_io::write_stderr("Bundle " + bundle + " could not be read: " + verifier.error() + "\n");
+            this->return_code = static_cast<int>(UPDATER_VERIFY_STATE::VERIFY_READ_FAILED);
+            return;
+        case BundleVerifier::Result::MANIFEST_INVALID:
+            cli_io::write_stderr("Bundle " + bundle + " is invalid: " + verifier.error() + "\n");
+            this->return_code = static_cast<int>(UPDATER_VERIFY_STATE::VERIFY_MANIFEST_INVALID);
+            return;
+        case BundleVerifier::Result::VERIFIED:
+        case BundleVerifier::Result::MISMATCH:
+            break;
+    }
+
+    string report;
+    for (const auto &component : verifier.components())
+    {
+        report += component_line(component);
+        if (component.sha256.empty())
+        {
+            report += ": missing in bundle\n";
+        }
+        else if (component.sha256 != component.expected_sha256)
+        {
+            report += ": sha256 mismatch, " + std::to_string(component.size) + " bytes\n";
+        }
+        else
+        {
+            report += ": ok, " + std::to_string(component.size) + " bytes, " +
+                      throughput(component.size, component.nanoseconds) + "\n";
+        }
+    }
+    this->report->set("cached", false);
+    this->report->set("components", static_cast<uint64_t>(verifier.components().size()));
+    this->report->set("bytes_read", verifier.bytes_read());
+    this->report->set("duration_ms", verifier.nanoseconds() / 1000000U);
+    if (this->metrics != nullptr)
+    {
+        this->metrics->set("fs_updater_verify_duration_seconds", static_cast<double>(verifier.nanoseconds()) / 1e9);
+        this->metrics->set("fs_updater_verify_bytes", static_cast<double>(verifier.bytes_read()));
+    }
+    report += std::to_string(verifier.bytes_read()) + " bytes read in " + seconds(verifier.nanoseconds()) +
+              " (" + throughput(verifier.bytes_read(), verifier.nanoseconds()) + ")\n";
+
+    if (result == BundleVerifier::Result::VERIFIED)
+    {
+        cli_io::write_stdout(report + "Bundle verified.\n");
+        this->return_code = static_cast<int>(UPDATER_VERIFY_STATE::VERIFY_SUCCESSFUL);
+    }
+    else
+    {
+        cli_io::write_stdout(report);
+        cli_io::write_stderr("Bundle " + bundle + " failed verification.\n");
+        this->return_code = static_cast<int>(UPDATER_VERIFY_STATE::VERIFY_MISMATCH);
+    }
+}
@@ -0,0 +1,293 @@
+#include "cli.h"
+#include "fs_updater_error.h"
+#include "posix_helpers.h"
+#include "InotifyWatch.h"
+#include "cli_io.h"
+
+#include <chrono>
+#include <cstring>
+
+using std::string;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /* Signal files are created, rewritten and removed; the directory may itself be removed. */
+    constexpr uint32_t WORK_DIR_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM |
+                                         IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF;
+    /* Directory watch reports IN_MODIFY for every write to the download target. */
+    constexpr uint32_t TARGET_DIR_EVENTS = IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE;
+
+    string parent_dir(const string &path)
+    {
+        const string::size_type slash = path.find_last_of('/');
+        if (slash == string::npos) { return "."; }
+        if (slash == 0) { return "/"; }
+        return path.substr(0, slash);
+    }
+
+    uint64_t bytes_per_second(uint64_t bytes, Clock::duration elapsed)
+    {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        return (ms > 0) ? (bytes * 1000U) / static_cast<uint64_t>(ms) : 0U;
+    }
+
+    struct Sample
+    {
+        Clock::time_point time;
+        uint64_t loaded{0};
+    };
+}
+
+// ---------------------------------------------------------------------------
+// --download_progress --watch
+// ---------------------------------------------------------------------------
+
+void cli::fs_update_cli::watch_download_progress()
+{
+    InotifyWatch watch;
+    const string &work_dir = this->work_dir();
+    if (!watch.valid() || watch.add(work_dir, WORK_DIR_EVENTS) < 0)
+    {
+        cli_io::write_stderr("Cannot watch " + work_dir + ": " + strerror(errno) + "\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::WATCH_FAILED);
+        return;
+    }
+
+    const auto interval = std::chrono::milliseconds(this->arg_watch_interval.getValue());
+    string target_dir;
+    int target_wd = -1;
+    int printed_code = -1;
+    bool started = false;
+    Sample first;
+    Sample last;
+    Clock::time_point last_print;
+
+    for (;;)
+    {
+        static_cast<void>(this->work_dir_index.refresh(work_dir));
+        DownloadStatus status;
+        const int code = this->read_download_progress(status, false);
+
+        /* The target may live outside the work directory and appear later. */
+        if (!status.target.empty())
+        {
+            const string dir = parent_dir(status.target);
+            if (dir != target_dir)
+            {
+                watch.remove(target_wd);
+                target_wd = (dir != work_dir) ? watch.add(dir, TARGET_DIR_EVENTS) : -1;
+                target_dir = dir;
+                /* Changes between the probe and add() were not seen; probe again. */
+                continue;
+            }
+        }
+
+        const Clock::time_point now = Clock::now();
+        if (code == static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_IN_PROGRESS) ||
+            code == static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_FINISHED))
+        {
+            if (!started)
+            {
+                started = true;
+                first = Sample{now, status.loaded};
+                last = first;
+            }
+            if (code != printed_code || status.loaded != last.loaded)
+            {
+                const uint64_t percent = (status.loaded * 100U) / status.update_size;
+                const uint64_t current = bytes_per_second(status.loaded - last.loaded, now - last.time);
+                const uint64_t average = bytes_per_second(status.loaded - first.loaded, now - first.time);
+                const uint64_t remaining = (status.update_size > status.loaded) ? status.update_size - status.loaded : 0U;
+
+                string line = std::to_string(status.loaded) + "/" + std::to_string(status.update_size)
+                    + " -- " + std::to_string(percent) + "%"
+                    + " -- " + std::to_string(current / 1024U) + " KiB/s"
+                    + ", avg " + std::to_string(average / 1024U) + " KiB/s"
+                    + ", ETA " + ((average > 0U) ? std::to_string(remaining / average) + " s" : string("--"))
+                    + "\n";
+                cli_io::write_stdout(line);
+                last = Sample{now, status.loaded};
+                last_print = now;
+            }
+        }
+        else if (code != printed_code)
+        {
+            if (code == static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_WAITING_TO_START))
+            {
+                cli_io::write_stdout("Waiting to start download.\n");
+            }
+            last_print = now;
+        }
+        printed_code = code;
+
+        /* An empty target means the download is gone; a zero-size target has just been created. */
+        if (code == static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::UPDATE_DOWNLOAD_FINISHED) ||
+            (code == static_cast<int>(UPDATER_DOWNLOAD_PROGRESS_STATE::NO_DOWNLOAD_STARTED) && status.target.empty()))
+        {
+            this->return_code = code;
+            return;
+        }
+
+        /* Sleep until something changes, then coalesce events until the interval has passed. */
+        if (watch.wait(-1, nullptr) < 0 && errno != EINTR)
+        {
+            cli_io::write_stderr(string("Watch failed: ") + strerror(errno) + "\n");
+            this->return_code = static_cast<int>(UPDATER_SYSTEM::WATCH_FAILED);
+            return;
+        }
+        for (auto wait_left = (last_print + interval) - Clock::now();
+             wait_left > Clock::duration::zero();
+             wait_left = (last_print + interval) - Clock::now())
+        {
+            const auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wait_left).count() + 1;
+            static_cast<void>(watch.wait(static_cast<int>(wait_ms), nullptr));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// --wait_for
+// ---------------------------------------------------------------------------
+
+namespace
+{
+    constexpr uint32_t SIGNAL_EVENTS = IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE |
+                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    constexpr uint32_t ANCESTOR_EVENTS = IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+    /* -1 waits without limit */
+    int remaining_ms(bool bounded, Clock::time_point deadline)
+    {
+        if (!bounded) { return -1; }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return (left > 0) ? static_cast<int>(left) : 0;
+    }
+}
+
+void cli::fs_update_cli::handle_wait_for()
+{
+    const string signal = this->arg_wait_for.getValue();
+    WorkDir::Entry entry;
+    if (!WorkDir::lookup(signal, entry))
+    {
+        cli_io::write_stderr("Unknown signal file: " + signal + "\n");
+        this->return_code = static_cast<int>(UPDATER_WAIT_STATE::INVALID_SIGNAL);
+        return;
+    }
+
+    const string &work_dir = this->work_dir();
+    const string signal_path = posix_helpers::path_join(work_dir, signal);
+    const bool bounded = this->arg_timeout.getValue() > 0U;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(this->arg_timeout.getValue());
+
+    InotifyWatch watch;
+    if (!watch.valid())
+    {
+        cli_io::write_stderr(string("Cannot create inotify instance: ") + strerror(errno) + "\n");
+        this->return_code = static_cast<int>(UPDATER_SYSTEM::WATCH_FAILED);
+        return;
+    }
+
+    bool work_dir_seen = false;
+    for (;;)
+    {
+        const int wd = watch.add(work_dir, SIGNAL_EVENTS);
+        if (wd >= 0)
+        {
+            work_dir_seen = true;
+            bool appeared = posix_helpers::path_exists(signal_path.c_str());
+            bool removed = false;
+
+            while (!appeared && !removed)
+            {
+                const int events = watch.wait(remaining_ms(bounded, deadline),
+                    [&](const struct inotify_event &event) {
+                        /* Skip late events of an ancestor watch */
+                        if (event.wd != wd)
+                        {
+                            return;
+                        }
+                        if ((event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) != 0U)
+                        {
+                            removed = true;
+                        }
+                        else if (event.len > 0U && signal == event.name)
+                        {
+                            appeared = true;
+                        }
+                    });
+                if (events < 0 && errno != EINTR)
+                {
+                    cli_io::write_stderr(string("Watch failed: ") + strerror(errno) + "\n");
+                    this->return_code = static_cast<int>(UPDATER_SYSTEM::WATCH_FAILED);
+                    return;
+                }
+                if (bounded && Clock::now() >= deadline)
+                {
+                    break;
+                }
+            }
+
+            if (appeared)
+            {
+                cli_io::write_stdout("Signal " + signal + " present\n");
+                this->return_code = static_cast<int>(UPDATER_WAIT_STATE::SIGNAL_PRESENT);
+            }
+            else if (removed)
+            {
+                cli_io::write_stdout("Work directory " + work_dir + " removed while waiting for " + signal + "\n");
+                this->return_code = static_cast<int>(UPDATER_WAIT_STATE::WORK_DIR_REMOVED);
+            }
+            else
+            {
+                cli_io::write_stdout("Timed out waiting for " + signal + "\n");
+                this->return_code = static_cast<int>(UPDATER_WAIT_STATE::WAIT_TIMED_OUT);
+            }
+            return;
+        }
+
+        if (errno != ENOENT && errno != ENOTDIR)
+        {
+            cli_io::write_stderr("Cannot watch " + work_dir + ": " + strerror(errno) + "\n");
+            this->return_code = static_cast<int>(UPDATER_SYSTEM::WATCH_FAILED);
+            return;
+        }
+        if (work_dir_seen)
+        {
+            /* Removed between two events */
+            cli_io::write_stdout("Work directory " + work_dir + " removed while waiting for " + signal + "\n");
+            this->return_code = static_cast<int>(UPDATER_WAIT_STATE::WORK_DIR_REMOVED);
+            return;
+        }
+
+        /* Not created yet (create_work_dir() runs at the start of a download):
+         * watch the nearest existing ancestor until the path is complete.
+         * Adding an already watched path returns its existing descriptor.
+         */
+        string ancestor = parent_dir(work_dir);
+        int ancestor_wd = -1;
+        while ((ancestor_wd = watch.add(ancestor, ANCESTOR_EVENTS)) < 0 && ancestor != "/")
+        {
+            ancestor = parent_dir(ancestor);
+        }
+        if (ancestor_wd < 0)
+        {
+            cli_io::write_stderr("Cannot watch " + ancestor + ": " + strerror(errno) + "\n");
+            this->return_code = static_cast<int>(UPDATER_SYSTEM::WATCH_FAILED);
+            return;
+        }
+
+        if (!posix_helpers::path_exists(work_dir.c_str()))
+        {
+            static_cast<void>(watch.wait(remaining_ms(bounded, deadline), nullptr));
+            if (bounded && Clock::now() >= deadline)
+            {
+                cli_io::write_stdout("Timed out waiting for " + signal + "\n");
+                this->return_code = static_cast<int>(UPDATER_WAIT_STATE::WAIT_TIMED_OUT);
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+
+/**
+ * Wire protocol between `fs-updater --client` and `fs-updater --daemon`.
+ *
+ * Request:  uint32_t payload length, carrying the client's stdout and stderr
+ *           as SCM_RIGHTS, followed by the action arguments, each terminated by '\0'.
+ * Response: int32_t return code, sent after the handler finished writing
+ *           its output to the passed descriptors.
+ *
+ * The daemon serves one client at a time, so it reads a request only
+ * until a deadline; a client that stalls before the end is dropped.
+ */
+namespace daemon_protocol {
+
+constexpr uint32_t MAX_REQUEST_SIZE = 4096;
+
+[[nodiscard]] inline bool send_all(int fd, const void* data, size_t size) noexcept
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+[[nodiscard]] inline bool recv_all(int fd, void* data, size_t size) noexcept
+{
+    char* ptr = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t n = ::recv(fd, ptr, size, 0);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/* Wait until fd is readable; errno ETIMEDOUT once the deadline has passed. */
+[[nodiscard]] inline bool wait_readable(int fd, std::chrono::steady_clock::time_point deadline) noexcept
+{
+    for (;;)
+    {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) { errno = ETIMEDOUT; return false; }
+        pollfd pfd{fd, POLLIN, 0};
+        const int n = ::poll(&pfd, 1, static_cast<int>(left));
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0) { return false; }
+        if (n > 0) { return true; }
+    }
+}
+
+[[nodiscard]] inline bool recv_until(int fd, void* data, size_t size,
+                                     std::chrono::steady_clock::time_point deadline) noexcept
+{
+    char* ptr = static_cast<char*>(data);
+    while (size > 0)
+    {
+        if (!wait_readable(fd, deadline)) { return false; }
+        const ssize_t n = ::recv(fd, ptr, size, MSG_DONTWAIT);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) { continue; }
+        if (n <= 0) { return false; }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+[[nodiscard]] inline bool connect_socket(const char* path, int& sock) noexcept
+{
+    sockaddr_un addr{};
+    if (std::strlen(path) >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return false; }
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path);
+
+    sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) { return false; }
+    if (::connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        const int saved = errno;
+        ::close(sock);
+        sock = -1;
+        errno = saved;
+        return false;
+    }
+    return true;
+}
+
+[[nodiscard]] inline bool send_request(int sock, const std::vector<std::string>& args,
+                                       int out_fd, int err_fd) noexcept
+{
+    std::string payload;
+    for (const auto& arg : args)
+    {
+        payload.append(arg);
+        payload.push_back('\0');
+    }
+    if (payload.size() > MAX_REQUEST_SIZE) { errno = E2BIG; return false; }
+
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    const int fds[2] = {out_fd, err_fd};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+    iovec iov{&length, sizeof(length)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (::sendmsg(sock, &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(length))) { return false; }
+    return send_all(sock, payload.data(), payload.size());
+}
+
+[[nodiscard]] inline bool receive_request(int sock, std::vector<std::string>& args,
+                                          int& out_fd, int& err_fd,
+                                          std::chrono::milliseconds timeout) noexcept
+{
+    out_fd = -1;
+    err_fd = -1;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    uint32_t length = 0;
+    int fds[2] = {-1, -1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+    iovec iov{&length, sizeof(length)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (!wait_readable(sock, deadline)) { return false; }
+    const ssize_t received = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+
+    /* Descriptors that arrived are taken even if the request is cut short, so the caller closes them. */
+    const cmsghdr* cmsg = (received > 0) ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+    {
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+    out_fd = fds[0];
+    err_fd = fds[1];
+
+    if (received != static_cast<ssize_t>(sizeof(length)) ||
+        out_fd < 0 || err_fd < 0 || length > MAX_REQUEST_SIZE) { return false; }
+
+    std::string payload(length, '\0');
+    if (!recv_until(sock, payload.data(), payload.size(), deadline)) { return false; }
+
+    args.clear();
+    std::string::size_type start = 0;
+    while (start < payload.size())
+    {
+        const std::string::size_type end = payload.find('\0', start);
+        if (end == std::string::npos) { return false; }
+        args.emplace_back(payload, start, end - start);
+        start = end + 1;
+    }
+    return true;
+}
+
+} // namespace daemon_protocol
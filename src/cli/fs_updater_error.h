@@ -97,11 +97,39 @@ enum class UPDATER_CLI_VALIDATION : int{
     MISSING_ENV_UPDATE_STICK  = 62,
     MISSING_ENV_UPDATE_FILE   = 63,
     UPDATE_TYPE_WITHOUT_FILE  = 64,
-    INCOMPATIBLE_ARG_COMBO    = 65
+    INCOMPATIBLE_ARG_COMBO    = 65,
+    BATCH_FILE_NOT_FOUND      = 66,
+    MODIFIER_WITHOUT_ACTION   = 67,
+    INVALID_RESOURCE_LIMIT    = 68
 };
 
 enum class UPDATER_SYSTEM : int{
-    REBOOT_FAILED             = 70
+    REBOOT_FAILED             = 70,
+    DAEMON_UNAVAILABLE        = 71,
+    DAEMON_SOCKET_FAILED      = 72,
+    WATCH_FAILED              = 73,
+    UPDATE_STREAM_FAILED      = 74
+};
+
+enum class UPDATER_WAIT_STATE : int{
+    SIGNAL_PRESENT            = 75,
+    WAIT_TIMED_OUT            = 76,
+    WORK_DIR_REMOVED          = 77,
+    INVALID_SIGNAL            = 78
+};
+
+enum class UPDATER_VERIFY_STATE : int{
+    VERIFY_SUCCESSFUL         = 80,
+    VERIFY_MISMATCH           = 81,
+    VERIFY_MANIFEST_INVALID   = 82,
+    VERIFY_READ_FAILED        = 83
+};
+
+enum class UPDATER_DELTA_STATE : int{
+    DELTA_SOURCE_MISMATCH     = 85,
+    DELTA_TARGET_MISMATCH     = 86,
+    DELTA_INVALID             = 87,
+    DELTA_APPLY_FAILED        = 88
 };
 
 enum class UPDATER_FATAL : int{
@@ -45,6 +45,20 @@ namespace posix_helpers {
     return true;
 }
 
+[[nodiscard]] inline bool read_fd(int fd, std::string& out) noexcept
+{
+    out.clear();
+    char buf[4096];
+    for (;;)
+    {
+        const ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0) { return false; }
+        if (n == 0) { return true; }
+        out.append(buf, static_cast<std::string::size_type>(n));
+    }
+}
+
 [[nodiscard]] inline bool create_marker_file(const char* path) noexcept
 {
     const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
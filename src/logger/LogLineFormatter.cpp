@@ -0,0 +1,120 @@
+#include "LogLineFormatter.h"
+#include "config.h"
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+    struct Literal
+    {
+        const char *text;
+        size_t length;
+    };
+
+    template <size_t N>
+    constexpr Literal literal(const char (&text)[N])
+    {
+        return Literal{text, N - 1};
+    }
+
+    constexpr Literal PREFIX_DEBUG = literal("DEBUG: [");
+    constexpr Literal PREFIX_WARNING = literal("WARNING: [");
+    constexpr Literal PREFIX_ERROR = literal("ERROR: [");
+    constexpr Literal SEPARATOR_DOMAIN = literal("] - ");
+    constexpr Literal SEPARATOR_MESSAGE = literal(": ");
+
+    constexpr size_t TIMESTAMP_LENGTH = 19; /* YYYY-mm-dd HH:MM:SS */
+
+    /* localtime_r() may consult the timezone database; do it once per second per thread. */
+    struct TimestampCache
+    {
+        std::time_t second{-1};
+        char text[TIMESTAMP_LENGTH + 1]{};
+    };
+
+    thread_local TimestampCache timestamp_cache;
+
+    const char *timestamp(std::time_t second) noexcept
+    {
+        if (second != timestamp_cache.second)
+        {
+            std::tm time_buf{};
+            localtime_r(&second, &time_buf);
+            if (std::strftime(timestamp_cache.text, sizeof(timestamp_cache.text),
+                              "%Y-%m-%d %H:%M:%S", &time_buf) != TIMESTAMP_LENGTH)
+            {
+                std::memset(timestamp_cache.text, '?', TIMESTAMP_LENGTH);
+                timestamp_cache.text[TIMESTAMP_LENGTH] = '\0';
+            }
+            timestamp_cache.second = second;
+        }
+        return timestamp_cache.text;
+    }
+
+    /* Appends as much of text as fits; returns the new position. */
+    size_t append(char *out, size_t pos, size_t size, const char *text, size_t length) noexcept
+    {
+        const size_t room = size - pos;
+        const size_t count = (length < room) ? length : room;
+        std::memcpy(out + pos, text, count);
+        return pos + count;
+    }
+}
+
+namespace logger
+{
+    bool LogLineFormatter::accepts(logLevel sink_level, logLevel entry_level) noexcept
+    {
+        /* Library entries below FUS_CLI_MIN_LOG_LEVEL are dropped before any formatting. */
+        switch (entry_level)
+        {
+            case logLevel::DEBUG:
+                return (FUS_CLI_MIN_LOG_LEVEL <= 0) && (sink_level == logLevel::DEBUG);
+            case logLevel::WARNING:
+                return (FUS_CLI_MIN_LOG_LEVEL <= 1) &&
+                       (sink_level == logLevel::DEBUG || sink_level == logLevel::WARNING);
+            case logLevel::ERROR:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    size_t LogLineFormatter::format(const LogEntry &entry, char *out, size_t size, bool newline) noexcept
+    {
+        Literal prefix = PREFIX_ERROR;
+        switch (entry.getLogLevel())
+        {
+            case logLevel::DEBUG:
+                prefix = PREFIX_DEBUG;
+                break;
+            case logLevel::WARNING:
+                prefix = PREFIX_WARNING;
+                break;
+            default:
+                break;
+        }
+
+        /* Keep one byte for the newline so truncated lines stay terminated. */
+        const size_t limit = (newline && size > 0) ? size - 1 : size;
+        const std::time_t second = std::chrono::system_clock::to_time_t(entry.getTimepoint());
+        const auto &domain = entry.getLogDomain();
+        const auto &message = entry.getLogMessage();
+
+        size_t pos = 0;
+        pos = append(out, pos, limit, prefix.text, prefix.length);
+        pos = append(out, pos, limit, timestamp(second), TIMESTAMP_LENGTH);
+        pos = append(out, pos, limit, SEPARATOR_DOMAIN.text, SEPARATOR_DOMAIN.length);
+        pos = append(out, pos, limit, domain.data(), domain.size());
+        pos = append(out, pos, limit, SEPARATOR_MESSAGE.text, SEPARATOR_MESSAGE.length);
+        pos = append(out, pos, limit, message.data(), message.size());
+
+        if (newline && pos < size && (pos == 0 || out[pos - 1] != '\n'))
+        {
+            out[pos++] = '\n';
+        }
+        return pos;
+    }
+}
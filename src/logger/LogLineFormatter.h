@@ -0,0 +1,36 @@
+#pragma once
+#include <fs_update_framework/logger/LoggerEntry.h>
+
+#include <cstddef>
+
+namespace logger
+{
+    /**
+     * Formats log entries as "LEVEL: [YYYY-mm-dd HH:MM:SS] - domain: message"
+     * into a caller-provided buffer, without heap allocation.
+     * The timestamp text is cached per thread and only rebuilt when the second changes.
+     */
+    class LogLineFormatter
+    {
+        public:
+            /// Buffer size that holds any line the sinks emit; longer lines are truncated.
+            static constexpr size_t LINE_MAX = 512;
+
+            /**
+             * @param sink_level Level the sink was created with.
+             * @param entry_level Level of the entry.
+             * @return true if a sink with sink_level outputs an entry of entry_level
+             *         and entry_level is not below FUS_CLI_MIN_LOG_LEVEL.
+             */
+            static bool accepts(logLevel sink_level, logLevel entry_level) noexcept;
+
+            /**
+             * @param entry Entry to format.
+             * @param out Destination buffer, not NUL-terminated.
+             * @param size Size of out.
+             * @param newline Append '\n' unless the message already ends with one.
+             * @return Number of bytes written to out.
+             */
+            static size_t format(const LogEntry &entry, char *out, size_t size, bool newline) noexcept;
+    };
+}
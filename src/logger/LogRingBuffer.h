@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "LogLineFormatter.h"
+
+namespace logger
+{
+    /**
+     * Bounded lock-free queue of formatted log lines (Vyukov MPMC algorithm).
+     * Producers are the logging threads; the serial writer thread consumes.
+     * Producers may also pop, which implements the drop-oldest policy.
+     */
+    class LogRingBuffer
+    {
+        public:
+            /// Longest line stored; longer lines are truncated.
+            static constexpr size_t LINE_MAX = LogLineFormatter::LINE_MAX;
+
+            struct Line
+            {
+                size_t length;
+                char text[LINE_MAX];
+            };
+
+            /**
+             * @param capacity Number of lines, must be a power of two.
+             */
+            explicit LogRingBuffer(size_t capacity)
+                : mask(capacity - 1), cells(std::make_unique<Cell[]>(capacity))
+            {
+                for (size_t i = 0; i < capacity; ++i)
+                {
+                    this->cells[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            LogRingBuffer(const LogRingBuffer &) = delete;
+            LogRingBuffer &operator=(const LogRingBuffer &) = delete;
+
+            /**
+             * @return false if the queue is full.
+             */
+            bool try_push(const char *data, size_t length) noexcept
+            {
+                Cell *cell = nullptr;
+                size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    cell = &this->cells[pos & this->mask];
+                    const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                    const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                    if (diff == 0)
+                    {
+                        if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        {
+                            break;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = this->enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+
+                cell->line.length = (length < LINE_MAX) ? length : LINE_MAX;
+                std::memcpy(cell->line.text, data, cell->line.length);
+                cell->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            /**
+             * @param out Receives the line; may be nullptr to discard it.
+             * @return false if the queue is empty.
+             */
+            bool try_pop(Line *out) noexcept
+            {
+                Cell *cell = nullptr;
+                size_t pos = this->dequeue_pos.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    cell = &this->cells[pos & this->mask];
+                    const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                    const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                    if (diff == 0)
+                    {
+                        if (this->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        {
+                            break;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = this->dequeue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+
+                if (out != nullptr)
+                {
+                    out->length = cell->line.length;
+                    std::memcpy(out->text, cell->line.text, cell->line.length);
+                }
+                cell->sequence.store(pos + this->mask + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool empty() const noexcept
+            {
+                return this->dequeue_pos.load(std::memory_order_acquire) ==
+                       this->enqueue_pos.load(std::memory_order_acquire);
+            }
+
+        private:
+            struct Cell
+            {
+                std::atomic<size_t> sequence;
+                Line line;
+            };
+
+            const size_t mask;
+            std::unique_ptr<Cell[]> cells;
+            alignas(64) std::atomic<size_t> enqueue_pos{0};
+            alignas(64) std::atomic<size_t> dequeue_pos{0};
+    };
+}
@@ -0,0 +1,25 @@
+#include "LoggerSinkConsole.h"
+#include "LogLineFormatter.h"
+
+#include <array>
+#include <unistd.h>
+
+namespace logger
+{
+    LoggerSinkConsole::LoggerSinkConsole(logger::logLevel level, int fd)
+        : log_level(level), output_fd(fd)
+    {
+    }
+
+    void LoggerSinkConsole::setLogEntry(const std::shared_ptr<logger::LogEntry>& entry) noexcept
+    {
+        if (!entry || !LogLineFormatter::accepts(this->log_level, entry->getLogLevel()))
+            return;
+
+        std::array<char, LogLineFormatter::LINE_MAX> line;
+        const size_t length = LogLineFormatter::format(*entry, line.data(), line.size(), true);
+
+        const ssize_t ret = ::write(this->output_fd, line.data(), length);
+        (void)ret;
+    }
+}
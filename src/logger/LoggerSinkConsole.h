@@ -0,0 +1,32 @@
+#pragma once
+#include <fs_update_framework/logger/LoggerSinkBase.h>
+
+namespace logger
+{
+    /**
+     * Stdout counterpart of LoggerSinkSerial.
+     * Each entry is formatted into a stack buffer and written with a single write(2),
+     * so lines of concurrent threads do not interleave.
+     */
+    class LoggerSinkConsole : public LoggerSinkBase
+    {
+        private:
+            const logger::logLevel log_level;
+            const int output_fd;
+
+        public:
+            /**
+             * @param level Set the expected log level which should be thrown
+             * @param fd Descriptor the lines are written to.
+             */
+            explicit LoggerSinkConsole(logger::logLevel level, int fd = 1);
+
+            ~LoggerSinkConsole() override = default;
+
+            /**
+             * Override virtual function and define the specific setLogEntry function for stdout.
+             * @param ptr Shared object of logger::LogEntry which should be log.
+             */
+            void setLogEntry(const std::shared_ptr<logger::LogEntry>& entry) noexcept override;
+    };
+}
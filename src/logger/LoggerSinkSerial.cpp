@@ -1,74 +1,156 @@
 #include "LoggerSinkSerial.h"
+#include "LogLineFormatter.h"
 #include <fs_update_framework/logger/LoggerEntry.h>
 #include <chrono>
-#include <ctime>
 #include <string>
 #include <array>
 
-namespace logger
+#include <sys/uio.h>
+
+namespace
 {
-    std::mutex LoggerSinkSerial::serial_mutex;
+    /* Lines per writev(); bounded by IOV_MAX and the writer's stack. */
+    constexpr size_t WRITE_BATCH = 32;
+}
 
+namespace logger
+{
     LoggerSinkSerial::LoggerSinkSerial(logger::logLevel level,
-                                       std::shared_ptr<SynchronizedSerial> port)
-        : log_level(level), serial_port(std::move(port))
+                                       std::shared_ptr<SynchronizedSerial> port,
+                                       OverflowPolicy policy,
+                                       size_t capacity)
+        : log_level(level), overflow_policy(policy), serial_port(std::move(port)), queue(capacity)
     {
+        this->writer = std::thread(&LoggerSinkSerial::run_writer, this);
+    }
+
+    LoggerSinkSerial::~LoggerSinkSerial()
+    {
+        this->stop_requested.store(true);
+        this->notify_writer();
+        if (this->writer.joinable())
+        {
+            this->writer.join();
+        }
+
+        const uint64_t dropped = this->dropped_oldest.load() + this->dropped_new.load();
+        if (dropped > 0)
+        {
+            this->serial_port->write("WARNING: serial log dropped " + std::to_string(dropped) + " entries\n");
+        }
     }
 
     void LoggerSinkSerial::setLogEntry(const std::shared_ptr<logger::LogEntry>& entry) noexcept
     {
-        if (!entry)
+        if (!entry || !LogLineFormatter::accepts(this->log_level, entry->getLogLevel()))
             return;
 
-        const auto entry_level = entry->getLogLevel();
-        bool should_output = false;
-        const char* level_prefix = nullptr;
+        std::array<char, LogLineFormatter::LINE_MAX> line;
+        const size_t length = LogLineFormatter::format(*entry, line.data(), line.size(), false);
+        this->enqueue(line.data(), length);
+    }
 
-        switch (entry_level)
+    void LoggerSinkSerial::enqueue(const char *data, size_t length) noexcept
+    {
+        while (!this->queue.try_push(data, length))
         {
-            case logLevel::DEBUG:
-                if (log_level == logLevel::DEBUG)
+            switch (this->overflow_policy)
+            {
+                case OverflowPolicy::DROP_NEW:
+                    this->dropped_new.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                case OverflowPolicy::DROP_OLDEST:
+                    if (this->queue.try_pop(nullptr))
+                    {
+                        this->dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    break;
+                case OverflowPolicy::BLOCK:
                 {
-                    level_prefix = "DEBUG";
-                    should_output = true;
+                    this->notify_writer();
+                    std::unique_lock<std::mutex> lock(this->wake_mutex);
+                    this->wake_producers.wait_for(lock, std::chrono::milliseconds(10));
+                    break;
                 }
+            }
+        }
+        this->notify_writer();
+    }
+
+    void LoggerSinkSerial::notify_writer()
+    {
+        /* Pairs with the fence in run_writer(): either the writer sees the new
+         * line, or this thread sees writer_sleeping and wakes it.
+         */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->writer_sleeping.load(std::memory_order_relaxed) || this->stop_requested.load())
+        {
+            std::lock_guard<std::mutex> lock(this->wake_mutex);
+            this->wake_writer.notify_one();
+        }
+    }
+
+    void LoggerSinkSerial::run_writer()
+    {
+        std::array<LogRingBuffer::Line, WRITE_BATCH> batch;
+        std::array<struct iovec, WRITE_BATCH> iov{};
+
+        for (;;)
+        {
+            this->writer_busy.store(true);
+            size_t count = 0;
+            while (count < batch.size() && this->queue.try_pop(&batch[count]))
+            {
+                iov[count].iov_base = batch[count].text;
+                iov[count].iov_len = batch[count].length;
+                ++count;
+            }
+
+            if (count > 0)
+            {
+                this->serial_port->writev(iov.data(), static_cast<int>(count));
+                this->wake_producers.notify_all();
+                continue;
+            }
+            this->writer_busy.store(false);
+
+            if (this->stop_requested.load())
+            {
                 break;
-            case logLevel::WARNING:
-                if (log_level == logLevel::DEBUG || log_level == logLevel::WARNING)
-                {
-                    level_prefix = "WARNING";
-                    should_output = true;
-                }
-                break;
-            case logLevel::ERROR:
-                level_prefix = "ERROR";
-                should_output = true;
-                break;
-            default:
-                return;
+            }
+
+            std::unique_lock<std::mutex> lock(this->wake_mutex);
+            this->writer_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->queue.empty() && !this->stop_requested.load())
+            {
+                /* Timeout bounds the latency of any missed wakeup. */
+                this->wake_writer.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            this->writer_sleeping.store(false, std::memory_order_relaxed);
+            this->wake_producers.notify_all();
         }
+    }
 
-        if (!should_output)
-            return;
+    void LoggerSinkSerial::flush() noexcept
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((!this->queue.empty() || this->writer_busy.load()) &&
+               std::chrono::steady_clock::now() < deadline)
+        {
+            this->notify_writer();
+            std::unique_lock<std::mutex> lock(this->wake_mutex);
+            this->wake_producers.wait_for(lock, std::chrono::milliseconds(5));
+        }
+    }
 
-        const auto time_t_val = std::chrono::system_clock::to_time_t(entry->getTimepoint());
-        std::tm time_buf{};
-        localtime_r(&time_t_val, &time_buf);
-
-        std::array<char, 20> time_str{};
-        std::strftime(time_str.data(), time_str.size(), "%Y-%m-%d %H:%M:%S", &time_buf);
-
-        std::string out;
-        out.reserve(128);
-        out.append(level_prefix);
-        out.append(": [");
-        out.append(time_str.data());
-        out.append("] - ");
-        out.append(entry->getLogDomain());
-        out.append(": ");
-        out.append(entry->getLogMessage());
-
-        std::lock_guard<std::mutex> lock(serial_mutex);
-        serial_port->write(out);
+    uint64_t LoggerSinkSerial::getDroppedOldest() const noexcept
+    {
+        return this->dropped_oldest.load(std::memory_order_relaxed);
+    }
+
+    uint64_t LoggerSinkSerial::getDroppedNew() const noexcept
+    {
+        return this->dropped_new.load(std::memory_order_relaxed);
     }
 }
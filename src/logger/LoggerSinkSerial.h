@@ -2,33 +2,101 @@
 #include <fs_update_framework/logger/LoggerSinkBase.h>
 
 #include "../cli/SynchronizedSerial.h"
+#include "LogRingBuffer.h"
+#include "config.h"
 
-#include <ctime>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 namespace logger
 {
+    /**
+     * Behaviour of LoggerSinkSerial when its ring buffer is full.
+     */
+    enum class OverflowPolicy
+    {
+        BLOCK,          ///< Wait for the writer thread to make room
+        DROP_OLDEST,    ///< Discard the oldest queued line
+        DROP_NEW        ///< Discard the line being logged
+    };
+
     class LoggerSinkSerial : public LoggerSinkBase
     {
         private:
             const logger::logLevel log_level;
+            const OverflowPolicy overflow_policy;
             std::shared_ptr<SynchronizedSerial> serial_port;
-            static std::mutex serial_mutex;
+            LogRingBuffer queue;
+
+            std::atomic<uint64_t> dropped_oldest{0};
+            std::atomic<uint64_t> dropped_new{0};
+
+            std::mutex wake_mutex;
+            std::condition_variable wake_writer;
+            std::condition_variable wake_producers;
+            std::atomic<bool> writer_sleeping{false};
+            std::atomic<bool> writer_busy{false};
+            std::atomic<bool> stop_requested{false};
+            std::thread writer;
+
+            /**
+             * Writer thread: drain the queue in batches with one writev() each.
+             */
+            void run_writer();
+
+            /**
+             * Wake the writer thread if it waits for new lines.
+             */
+            void notify_writer();
+
+            /**
+             * Queue one formatted line according to the overflow policy.
+             */
+            void enqueue(const char *data, size_t length) noexcept;
 
         public:
             /**
              * Init logger endpoint for serial interface.
+             * Lines are queued and written by a background thread, so callers never wait on the UART.
              * @param level Set the expected log level which should be thrown
              * @param ptr Set the dynamic shared object for access the serial output.
+             * @param policy Behaviour when the queue is full.
+             * @param capacity Queue size in lines, must be a power of two.
+             */
+            LoggerSinkSerial(logger::logLevel level, std::shared_ptr<SynchronizedSerial> ptr,
+                             OverflowPolicy policy = OverflowPolicy::FUS_CLI_SERIAL_LOG_OVERFLOW,
+                             size_t capacity = FUS_CLI_SERIAL_LOG_SLOTS);
+
+            /**
+             * Write all queued lines and stop the writer thread.
              */
-            LoggerSinkSerial(logger::logLevel level, std::shared_ptr<SynchronizedSerial> ptr);
+            ~LoggerSinkSerial() override;
 
-            ~LoggerSinkSerial() override = default;
+            LoggerSinkSerial(const LoggerSinkSerial &) = delete;
+            LoggerSinkSerial &operator=(const LoggerSinkSerial &) = delete;
 
             /**
              * Override virtual function and define the specific setLogEntry function for serial output.
              * @param ptr Shared object of logger::LogEntry which should be log.
              */
             void setLogEntry(const std::shared_ptr<logger::LogEntry>& entry) noexcept override;
+
+            /**
+             * Block until every line queued so far has been written to the serial port.
+             * Called before reboot and on exit.
+             */
+            void flush() noexcept;
+
+            /**
+             * @return Lines discarded by the DROP_OLDEST policy.
+             */
+            uint64_t getDroppedOldest() const noexcept;
+
+            /**
+             * @return Lines discarded by the DROP_NEW policy.
+             */
+            uint64_t getDroppedNew() const noexcept;
     };
 }